@@ -1,6 +1,8 @@
 #include "basesolver.h"
 #include <math.h>
 #include "externalmedialib.h"
+#include "solvermap.h"
+#include "statistics.h"
 
 //! Constructor.
 /*!
@@ -12,6 +14,7 @@
 */
 BaseSolver::BaseSolver(const string &mediumName, const string &libraryName, const string &substanceName)
 	: mediumName(mediumName), libraryName(libraryName), substanceName(substanceName){
+	_statisticsIndex = Statistics::registerSolver(SolverMap::solverKey(libraryName, substanceName));
 }
 
 //! Destructor
@@ -21,6 +24,11 @@ BaseSolver::BaseSolver(const string &mediumName, const string &libraryName, cons
 BaseSolver::~BaseSolver(){
 }
 
+//! Return the index of the solver in the call statistics
+int BaseSolver::statisticsIndex() const{
+	return _statisticsIndex;
+}
+
 //! Return molar mass (Default implementation provided)
 double BaseSolver::molarMass() const{
 	return _fluidConstants.MM;
@@ -56,6 +64,11 @@ double BaseSolver::criticalEntropy() const{
 	return _fluidConstants.sc;
 }
 
+//! Return all fluid constants
+const FluidConstants &BaseSolver::fluidConstants() const{
+	return _fluidConstants;
+}
+
 //! Set fluid constants
 /*!
   This function sets the fluid constants which are defined in the
@@ -67,6 +80,27 @@ double BaseSolver::criticalEntropy() const{
 void BaseSolver::setFluidConstants(){
 }
 
+//! Build the caches and tables that are otherwise built on first use
+/*!
+  This function is called when a solver is preloaded, so that the first
+  property calls of the simulation do not pay for the setup.
+
+  Default implementation does nothing
+*/
+void BaseSolver::warmUp(){
+}
+
+//! Return the approximate memory held by the solver
+/*!
+  Solvers with states, tables or caches should add them to the footprint
+  of the base solver returned by this default implementation.
+*/
+MemoryFootprint BaseSolver::memoryFootprint() const{
+	MemoryFootprint footprint;
+	footprint.caches = sizeof(BaseSolver) + mediumName.capacity() + libraryName.capacity() + substanceName.capacity();
+	return footprint;
+}
+
 //! Set state from p, h, and phase
 /*!
   This function sets the thermodynamic state record for the given pressure
@@ -151,6 +185,41 @@ void BaseSolver::setState_hs(double &h, double &s, int &phase, ExternalThermodyn
 	errorMessage((char*)"Internal error: setState_hs() not implemented in the Solver object");
 }
 
+//! Set state from d, u, and phase
+/*!
+  This function sets the thermodynamic state record for the given density
+  d, the specific internal energy u and the specified phase. The computed values are
+  written to the ExternalThermodynamicState property struct. These inputs are the
+  natural states of dynamic control-volume models (mass and energy balances).
+
+  Must be re-implemented in the specific solver
+  @param d Density
+  @param u Specific internal energy
+  @param phase Phase (2 for two-phase, 1 for one-phase, 0 if not known)
+  @param properties ExternalThermodynamicState property struct
+*/
+void BaseSolver::setState_du(double &d, double &u, int &phase, ExternalThermodynamicState *const properties){
+    // Base function returns an error if called - should be redeclared by the solver object
+	errorMessage((char*)"Internal error: setState_du() not implemented in the Solver object");
+}
+
+//! Set state from d, h, and phase
+/*!
+  This function sets the thermodynamic state record for the given density
+  d, the specific enthalpy h and the specified phase. The computed values are
+  written to the ExternalThermodynamicState property struct.
+
+  Must be re-implemented in the specific solver
+  @param d Density
+  @param h Specific enthalpy
+  @param phase Phase (2 for two-phase, 1 for one-phase, 0 if not known)
+  @param properties ExternalThermodynamicState property struct
+*/
+void BaseSolver::setState_dh(double &d, double &h, int &phase, ExternalThermodynamicState *const properties){
+    // Base function returns an error if called - should be redeclared by the solver object
+	errorMessage((char*)"Internal error: setState_dh() not implemented in the Solver object");
+}
+
 //! Compute partial derivative from a populated state record
 /*!
   This function computes the derivative of the specified input. Note that it requires
@@ -10,6 +10,21 @@
 
 struct FluidConstants;
 
+/*! Approximate memory held by a solver, in bytes */
+struct MemoryFootprint{
+	/*! Property states of the external library */
+	size_t states;
+	/*! Tables of the external library, like the CoolProp TTSE and bicubic tables */
+	size_t tables;
+	/*! Tables built by the solver */
+	size_t nativeTables;
+	/*! Solver object and caches */
+	size_t caches;
+
+	MemoryFootprint() : states(0), tables(0), nativeTables(0), caches(0){}
+	size_t total() const { return states + tables + nativeTables + caches; }
+};
+
 /*! Base solver class. */
 /*!
   This is the base class for all external solver objects
@@ -34,14 +49,21 @@ public:
 	double criticalDensity() const;
 	double criticalEnthalpy() const;
 	double criticalEntropy() const;
+	const FluidConstants &fluidConstants() const;
 
 	virtual void setFluidConstants();
+	virtual void warmUp();
+	virtual MemoryFootprint memoryFootprint() const;
+
+	int statisticsIndex() const;
 
 	virtual void setState_ph(double &p, double &h, int &phase, ExternalThermodynamicState *const properties);
 	virtual void setState_pT(double &p, double &T, ExternalThermodynamicState *const properties);
 	virtual void setState_dT(double &d, double &T, int &phase, ExternalThermodynamicState *const properties);
 	virtual void setState_ps(double &p, double &s, int &phase, ExternalThermodynamicState *const properties);
 	virtual void setState_hs(double &h, double &s, int &phase, ExternalThermodynamicState *const properties);
+	virtual void setState_du(double &d, double &u, int &phase, ExternalThermodynamicState *const properties);
+	virtual void setState_dh(double &d, double &h, int &phase, ExternalThermodynamicState *const properties);
 
 	virtual double partialDeriv_state(const string &of, const string &wrt, const string &cst, ExternalThermodynamicState *const properties);
 
@@ -100,6 +122,8 @@ public:
 protected:
 	/*! Fluid constants */
 	FluidConstants _fluidConstants;
+	/*! Index of the solver in the call statistics */
+	int _statisticsIndex;
 };
 
 #endif /* BASESOLVER_H_ */
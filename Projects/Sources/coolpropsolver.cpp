@@ -1,4 +1,7 @@
 #include "coolpropsolver.h"
+#include "statistics.h"
+#include "memostore.h"
+#include "solvermap.h"
 
 #include "include.h"
 #if (EXTERNALMEDIA_COOLPROP == 1)
@@ -7,6 +10,8 @@
 #include "CoolPropLib.h"
 #include "CoolProp.h"
 #include "AbstractState.h"
+#include "Configuration.h"
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <stdlib.h>
@@ -16,13 +21,28 @@
 //double _delta_h ; // delta_h for one-phase/two-phase discrimination
 //ExternalSaturationProperties *_satPropsClose2Crit; // saturation properties close to  critical conditions
 
+/// Let CoolProp cache its TTSE and bicubic tables in EXTERNALMEDIA_TABLE_DIRECTORY
+/*
+  The tables are only built once per host, every process still loads its
+  own copy.
+*/
+static bool configureTableDirectory(){
+	const char *directory = getenv("EXTERNALMEDIA_TABLE_DIRECTORY");
+	if (!directory || !*directory)
+		return false;
+	CoolProp::set_config_string(CoolProp::ALTERNATIVE_TABLES_DIRECTORY, std::string(directory));
+	return true;
+}
+
 CoolPropSolver::CoolPropSolver(const std::string &mediumName, const std::string &libraryName, const std::string &substanceName)
 	: BaseSolver(mediumName, libraryName, substanceName){
 
+	// Startup phases are recorded in the call statistics
+	StatisticsTimer timer(this, Statistics::createSolver_options);
+
 	// Fluid name can be used to pass in other parameters.
 	// The string can be composed like "Propane|enable_TTSE=1|calc_transport=0"
 	std::vector<std::string> name_options = strsplit(substanceName,'|');
-	std::vector<std::string> library_options = strsplit(libraryName,'|');
 
 	// Set the defaults
 	enable_TTSE     = false;
@@ -32,30 +52,43 @@ CoolPropSolver::CoolPropSolver(const std::string &mediumName, const std::string
 	extend_twophase = true;
 	twophase_derivsmoothing_xend = 0;
 	rho_smoothing_xend = 0;
-
-	//Check if a backend has been added to the fluid name (ex: REFPROP::Propane)
-    std::string backend;
-    CoolProp::extract_backend(name_options[0], backend, this->substanceName);
-
-    // Set the default composition
-    std::vector<double> fractions(1, 1.0);
-    const std::vector<double> *fractions_ptr = NULL;
-    this->substanceName = CoolProp::extract_fractions(this->substanceName, fractions);
-    fractions_ptr = &fractions;
-
-	if (backend == "?") // If no backend found in the fluid name
-	{
-		if (library_options.size() > 1)	//Check if an option has been added to libraryName (should be the case for all incompressible)
-		{
-			backend = library_options[1]; // [0] is always "CoolProp", [1] should be the option if any
-		}
-		else
-		{
-			//No backend found, default to HEOS
-			backend = "HEOS";
-		}
+	_hasSurfaceTension = false;
+	_surfaceTensionProbed = false;
+	_close2CritReady = false;
+	_tabular = false;
+	_memo = NULL;
+	_memoSolver = 0;
+	twophase_endpoint_cache = true;
+	twophase_cache_ptol = 0;
+	taylor_cache_rtol = 0;
+	_taylorCacheNext = 0;
+	for (int i = 0; i < _nTaylorCache; i++)
+		_taylorCache[i].p = NAN;
+	_twoPhaseCacheNext = 0;
+	_splineNative = true;
+	twophase_spline_table = 0;
+	warmstart_index = 0;
+	flash_max_iter = 0;
+	flash_max_time = 0;
+	flash_fallback_approximate = false;
+	check_range = false;
+	_enthalpyBoundsReady = false;
+	_failureCacheNext = 0;
+	_fallbackSwapped = false;
+	_lastT = NAN;
+	_lastD = NAN;
+	_lastPhase = CoolProp::iphase_unknown;
+	_splineCacheNext = 0;
+	for (int i = 0; i < _nTwoPhaseCache; i++){
+		_twoPhaseCache[i].p = NAN;
+		_splineCache[i].p = NAN;
 	}
 
+	// Backend, fluid name and composition
+	std::string backend;
+	std::vector<double> fractions;
+	parseSubstance(libraryName, substanceName, backend, this->substanceName, fractions);
+
 	// Initialise the saturation and near-critical variables
 	_p_eps   = 1e-3; // relative tolerance margin for subcritical pressure conditions
 	_delta_h = 1e-1; // delta_h for one-phase/two-phase discrimination
@@ -136,6 +169,111 @@ CoolPropSolver::CoolPropSolver(const std::string &mediumName, const std::string
 				if (rho_smoothing_xend<0 || rho_smoothing_xend > 1)
 					errorMessage((char*)format("I don't know how to handle this rho_smoothing_xend value [%d]",param_val[0].c_str()).c_str());
 			}
+			else if (!param_val[0].compare("twophase_endpoint_cache"))
+			{
+				if (!param_val[1].compare("1") || !param_val[1].compare("true"))
+				{
+					twophase_endpoint_cache = true;
+				}
+				else if (!param_val[1].compare("0") || !param_val[1].compare("false"))
+				{
+					twophase_endpoint_cache = false;
+				}
+				else
+				{
+					errorMessage((char*)format("I don't know how to handle this twophase_endpoint_cache value [%s]",param_val[1].c_str()).c_str());
+				}
+			}
+			else if (!param_val[0].compare("twophase_cache_ptol"))
+			{
+				twophase_cache_ptol = strtod(param_val[1].c_str(),NULL);
+				if (twophase_cache_ptol<0 || twophase_cache_ptol > 1)
+					errorMessage((char*)format("I don't know how to handle this twophase_cache_ptol value [%s]",param_val[1].c_str()).c_str());
+			}
+			else if (!param_val[0].compare("taylor_cache_rtol"))
+			{
+				taylor_cache_rtol = strtod(param_val[1].c_str(),NULL);
+				if (taylor_cache_rtol<0 || taylor_cache_rtol > 1e-3)
+					errorMessage((char*)format("I don't know how to handle this taylor_cache_rtol value [%s]",param_val[1].c_str()).c_str());
+			}
+			else if (!param_val[0].compare("twophase_spline_table"))
+			{
+				twophase_spline_table = (int)strtol(param_val[1].c_str(),NULL,0);
+				if (twophase_spline_table<0 || twophase_spline_table == 1 || twophase_spline_table > 100000)
+					errorMessage((char*)format("I don't know how to handle this twophase_spline_table value [%s]",param_val[1].c_str()).c_str());
+			}
+			else if (!param_val[0].compare("check_range"))
+			{
+				if (!param_val[1].compare("1") || !param_val[1].compare("true"))
+				{
+					check_range = true;
+				}
+				else if (!param_val[1].compare("0") || !param_val[1].compare("false"))
+				{
+					check_range = false;
+				}
+				else
+				{
+					errorMessage((char*)format("I don't know how to handle this check_range value [%s]",param_val[1].c_str()).c_str());
+				}
+			}
+			else if (!param_val[0].compare("fallback_chain"))
+			{
+				std::vector<std::string> stages = strsplit(param_val[1],',');
+				_fallbackChain.clear();
+				for (size_t j = 0; j < stages.size(); j++)
+				{
+					if (!stages[j].compare("guesses"))
+						_fallbackChain.push_back(fallbackGuesses);
+					else if (!stages[j].compare("phase"))
+						_fallbackChain.push_back(fallbackPhase);
+					else if (!stages[j].compare("eos"))
+						_fallbackChain.push_back(fallbackEos);
+					else if (stages[j].compare("none"))
+						errorMessage((char*)format("I don't know how to handle this fallback_chain stage [%s]",stages[j].c_str()).c_str());
+				}
+			}
+			else if (!param_val[0].compare("failure_cache"))
+			{
+				int size = (int)strtol(param_val[1].c_str(),NULL,0);
+				if (size<0 || size > 1000)
+					errorMessage((char*)format("I don't know how to handle this failure_cache value [%s]",param_val[1].c_str()).c_str());
+				FailedState empty = {-1, NAN, NAN, 0, ""};
+				_failureCache.assign(size, empty);
+			}
+			else if (!param_val[0].compare("flash_max_iter"))
+			{
+				flash_max_iter = (int)strtol(param_val[1].c_str(),NULL,0);
+				if (flash_max_iter<0 || flash_max_iter > 1000)
+					errorMessage((char*)format("I don't know how to handle this flash_max_iter value [%s]",param_val[1].c_str()).c_str());
+			}
+			else if (!param_val[0].compare("flash_max_time"))
+			{
+				flash_max_time = strtod(param_val[1].c_str(),NULL);
+				if (flash_max_time<0 || flash_max_time > 10)
+					errorMessage((char*)format("I don't know how to handle this flash_max_time value [%s]",param_val[1].c_str()).c_str());
+			}
+			else if (!param_val[0].compare("flash_fallback"))
+			{
+				if (!param_val[1].compare("error"))
+				{
+					flash_fallback_approximate = false;
+				}
+				else if (!param_val[1].compare("approximate"))
+				{
+					flash_fallback_approximate = true;
+				}
+				else
+				{
+					errorMessage((char*)format("I don't know how to handle this flash_fallback value [%s]",param_val[1].c_str()).c_str());
+				}
+			}
+			else if (!param_val[0].compare("warmstart_index"))
+			{
+				warmstart_index = (int)strtol(param_val[1].c_str(),NULL,0);
+				if (warmstart_index<0 || warmstart_index > 1000000)
+					errorMessage((char*)format("I don't know how to handle this warmstart_index value [%s]",param_val[1].c_str()).c_str());
+			}
 			else if (!param_val[0].compare("debug"))
 			{
 				debug_level = (int)strtol(param_val[1].c_str(),NULL,0);
@@ -161,33 +299,192 @@ CoolPropSolver::CoolPropSolver(const std::string &mediumName, const std::string
 
 	// Check if incompressible
 	isCompressible = (backend.find("INCOMP") == std::string::npos);
+	// The underlying equation of state, without TTSE or BICUBIC tables
+	_eosBackend = backend.substr(backend.rfind('&') + 1);
+	_tabular = (_eosBackend != backend);
 
 	// Create the state class
+	timer.restart(Statistics::createSolver_factory);
+	static const bool sharedTables = configureTableDirectory();
+	(void)sharedTables;
 	//this->state = CoolProp::AbstractState::factory(backend, this->substanceName);
-	this->state.reset(CoolProp::AbstractState::factory(backend, this->substanceName));
-    if (this->state->using_mole_fractions()){
-        // Skip predefined mixtures and pure fluids
-        if (this->state->get_mole_fractions().empty()){
-            this->state->set_mole_fractions(*fractions_ptr);
+	_fractions = fractions;
+	this->state.reset(newState(backend));
+
+    // Saturation at a given pressure or temperature is a single point only for pure fluids
+    _isPure = isCompressible && (this->state->fluid_names().size() == 1);
+    if (_isPure && !_eosBackend.compare("HEOS")) {
+        try {
+            // Pseudo-pure fluids have distinct bubble and dew lines
+            _isPure = !CoolProp::get_fluid_param_string(this->substanceName, "pure").compare("true");
+        } catch (...) {
+            _isPure = false;
         }
-    } else if (this->state->using_mass_fractions()){
-        this->state->set_mass_fractions(*fractions_ptr);
-    } else if (this->state->using_volu_fractions()){
-        this->state->set_volu_fractions(*fractions_ptr);
-    } else {
-        if (debug_level > 5) std::cout << format("%s:%d: CoolPropSolver could not set composition, defaulting to mole fractions.\n",__FILE__,__LINE__);
-        this->state->set_mole_fractions(*fractions_ptr);
     }
 
+    // Dedicated saturation states, the imposed phases are never changed
+    if (isCompressible) {
+        _satL.reset(newState(backend));
+        _satL->specify_phase(CoolProp::iphase_liquid);
+        _satV.reset(newState(backend));
+        _satV->specify_phase(CoolProp::iphase_gas);
+    }
+    // The dew line can be derived from the bubble line VLE solve (Clausius-Clapeyron),
+    // this needs (rho,T) inputs, which only the Helmholtz backends support (not IF97)
+    _sharedVLE = _isPure && !enable_TTSE && !enable_BICUBIC && (!_eosBackend.compare("HEOS") || !_eosBackend.compare("REFPROP"));
+
     // ... all is set, start using the state class.
+	timer.restart(Statistics::createSolver_constants);
 	this->setFluidConstants();
+	this->computeEnvelope();
+
+	// Warm starts of the p-s and h-s flashes, cells of 5% in pressure, 0.05 R*Tc/M in enthalpy and 0.05 R/M in entropy.
+	// The bounded flashes near the critical pressure keep their own indices with the same cells.
+	if (_isPure && !_tabular) {
+		double R_M = 8.314462618/_fluidConstants.MM;
+		if (warmstart_index > 0) {
+			initWarmStartIndex(_warmStartPS, warmstart_index, true, 0.05, 0.05*R_M);
+			initWarmStartIndex(_warmStartHS, warmstart_index, false, 0.05*R_M*_fluidConstants.Tc, 0.05*R_M);
+		}
+		if (flash_max_iter > 0) {
+			initWarmStartIndex(_boundedPH, _nBoundedIndex, true, 0.05, 0.05*R_M*_fluidConstants.Tc);
+			initWarmStartIndex(_boundedPS, _nBoundedIndex, true, 0.05, 0.05*R_M);
+		}
+	}
+
+	// States of earlier runs, the key includes the solver options and the CoolProp version
+	_memo = MemoStore::instance();
+	if (_memo)
+		_memoSolver = MemoStore::solverHash(SolverMap::solverKey(libraryName, substanceName) + "|CoolProp " +
+			CoolProp::get_global_param_string("version") + " " + CoolProp::get_global_param_string("gitrevision"));
 }
 
 
+/// Split the library and substance names into backend, fluid name and composition
+/*
+  The backend can be added to the fluid name (ex: REFPROP::Propane) or to the
+  library name (ex: CoolProp|INCOMP), HEOS is the default. The solver options
+  after the fluid name are not handled here.
+*/
+void CoolPropSolver::parseSubstance(const std::string &libraryName, const std::string &substanceName, std::string &backend, std::string &fluid, std::vector<double> &fractions){
+	std::vector<std::string> name_options = strsplit(substanceName,'|');
+	std::vector<std::string> library_options = strsplit(libraryName,'|');
+
+	//Check if a backend has been added to the fluid name (ex: REFPROP::Propane)
+	CoolProp::extract_backend(name_options[0], backend, fluid);
+
+	// Set the default composition
+	fractions.assign(1, 1.0);
+	fluid = CoolProp::extract_fractions(fluid, fractions);
+
+	if (backend == "?") // If no backend found in the fluid name
+	{
+		if (library_options.size() > 1)	//Check if an option has been added to libraryName (should be the case for all incompressible)
+		{
+			backend = library_options[1]; // [0] is always "CoolProp", [1] should be the option if any
+		}
+		else
+		{
+			//No backend found, default to HEOS
+			backend = "HEOS";
+		}
+	}
+}
+
+/// Set the composition of a new state, returns false if mole fractions were used by default
+bool CoolPropSolver::setComposition(CoolProp::AbstractState *newstate, const std::vector<double> &fractions){
+    if (newstate->using_mole_fractions()){
+        // Skip predefined mixtures and pure fluids
+        if (newstate->get_mole_fractions().empty()){
+            newstate->set_mole_fractions(fractions);
+        }
+    } else if (newstate->using_mass_fractions()){
+        newstate->set_mass_fractions(fractions);
+    } else if (newstate->using_volu_fractions()){
+        newstate->set_volu_fractions(fractions);
+    } else {
+        newstate->set_mole_fractions(fractions);
+        return false;
+    }
+	return true;
+}
+
+/// Create a new state instance for the solver fluid and composition
+CoolProp::AbstractState *CoolPropSolver::newState(const std::string &backend){
+	CoolProp::AbstractState *newstate = CoolProp::AbstractState::factory(backend, this->substanceName);
+	if (!setComposition(newstate, _fractions))
+		if (debug_level > 5) std::cout << format("%s:%d: CoolPropSolver could not set composition, defaulting to mole fractions.\n",__FILE__,__LINE__);
+	return newstate;
+}
+
+/// Fluid constants without constructing a solver
+/*
+  Only the equation of state is loaded, without tabular backends, saturation
+  states and solver options, which do not change the constants. The values
+  are the same as the ones of setFluidConstants. Returns false if the state
+  cannot be created, the solver then reports the error.
+*/
+bool CoolPropSolver::fluidConstants(const std::string &libraryName, const std::string &substanceName, FluidConstants &constants){
+	std::string backend, fluid;
+	std::vector<double> fractions;
+	try {
+		parseSubstance(libraryName, substanceName, backend, fluid, fractions);
+		if (backend.find("INCOMP") != std::string::npos) {
+			constants.pc = NAN;
+			constants.Tc = NAN;
+			constants.MM = NAN;
+			constants.dc = NAN;
+			return true;
+		}
+		shared_ptr<CoolProp::AbstractState> eos(CoolProp::AbstractState::factory(backend.substr(backend.rfind('&') + 1), fluid));
+		setComposition(eos.get(), fractions);
+		constants.pc = eos->p_critical();
+		constants.Tc = eos->T_critical();
+		constants.MM = eos->molar_mass();
+		constants.dc = eos->rhomass_critical();
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+
+/// The states and caches are owned by the members
 CoolPropSolver::~CoolPropSolver(){
-	//delete state;
 };
 
+/* Rough sizes of CoolProp objects, which cannot be queried */
+static const size_t _heosComponentBytes = 48*1024; /* data of one component of a HEOS state, copied in its two saturation states */
+static const size_t _otherStateBytes = 16*1024; /* incompressible, cubic, IF97 and REFPROP states */
+static const size_t _tableNodes = 200*200; /* nodes of each of the p-h and p-T tables */
+static const size_t _tableBytes = 2*_tableNodes*(48*sizeof(double) + 4*(16*sizeof(double) + 72)); /* values, derivatives and bicubic coefficients */
+
+/// Approximate memory held by the solver
+/*
+  The sizes of the CoolProp states and tables are estimated from the
+  backend, the number of components and the table dimensions. The tables
+  of a fluid are shared by all the solvers using them and are counted for
+  each one.
+*/
+MemoryFootprint CoolPropSolver::memoryFootprint() const{
+	MemoryFootprint footprint = BaseSolver::memoryFootprint();
+	size_t eosBytes = _otherStateBytes;
+	if (!_eosBackend.compare("HEOS"))
+		eosBytes = 3*state->fluid_names().size()*_heosComponentBytes;
+	// The tabular states hold an equation of state for the points outside the tables
+	size_t nStates = (state ? 1 : 0) + (_satL ? 1 : 0) + (_satV ? 1 : 0);
+	footprint.states = nStates*eosBytes + (_auxState ? eosBytes : 0) + (_fallbackState ? eosBytes : 0);
+	if (_tabular)
+		footprint.tables = _tableBytes;
+	for (map<double, std::vector<TwoPhaseSpline> >::const_iterator table = _splineTables.begin(); table != _splineTables.end(); ++table)
+		footprint.nativeTables += 4*sizeof(void*) + sizeof(*table) + table->second.capacity()*sizeof(TwoPhaseSpline);
+	footprint.caches += sizeof(CoolPropSolver) - sizeof(BaseSolver) + _fractions.capacity()*sizeof(double) + _eosBackend.capacity()
+		+ (_warmStartPS.slots.capacity() + _warmStartHS.slots.capacity() + _boundedPH.slots.capacity() + _boundedPS.slots.capacity())*sizeof(WarmStartEntry)
+		+ _failureCache.capacity()*sizeof(FailedState);
+	for (size_t i = 0; i < _failureCache.size(); i++)
+		footprint.caches += _failureCache[i].message.capacity();
+	return footprint;
+}
+
 
 void CoolPropSolver::setFluidConstants(){
 	if (isCompressible){
@@ -197,11 +494,9 @@ void CoolPropSolver::setFluidConstants(){
 		_fluidConstants.Tc = state->T_critical();
 		_fluidConstants.MM = state->molar_mass();
 		_fluidConstants.dc = state->rhomass_critical();
-		// Now we fill the close to crit record
-		if (debug_level > 5) std::cout << format("Setting near-critical saturation conditions for fluid %s \n",substanceName.c_str());
-		_satPropsClose2Crit.psat = _fluidConstants.pc*(1.0-_p_eps); // Needs update, setSat_p relies on it
-		setSat_p(_satPropsClose2Crit.psat, &_satPropsClose2Crit);
-
+		// The rest of the close to crit record is only computed when needed, see close2Crit()
+		_satPropsClose2Crit.psat = _fluidConstants.pc*(1.0-_p_eps); // setSat_p relies on it
+		_satPropsClose2Crit.Tsat = NAN;
 	}
 	else { // incompressible
 		if (debug_level > 5) std::cout << format("Setting constants for incompressible fluid %s \n",substanceName.c_str());
@@ -209,9 +504,309 @@ void CoolPropSolver::setFluidConstants(){
 		_fluidConstants.Tc = NAN;
 		_fluidConstants.MM = NAN; //state->molar_mass(); //NAN
 		_fluidConstants.dc = NAN;
+		_satPropsClose2Crit.psat = NAN;
+		_satPropsClose2Crit.Tsat = NAN;
+	}
+}
+
+/// Generic CoolProp flash, with the fallback chain if it fails
+/*
+  A failed flash rejects the step of the integrator, which costs far more
+  than retrying with another strategy. The stages of fallback_chain are tried
+  in turn, the error of the generic flash is reported if all of them fail.
+  Each stage is counted as a hit or miss event in the call statistics.
+*/
+void CoolPropSolver::flash(CoolProp::input_pairs inputs, double value1, double value2){
+	restoreState();
+	try {
+		state->update(inputs, value1, value2);
+	} catch (std::exception &) {
+		static const Statistics::Event hits[] = {Statistics::fallbackGuessesHit, Statistics::fallbackPhaseHit, Statistics::fallbackEosHit};
+		static const Statistics::Event misses[] = {Statistics::fallbackGuessesMiss, Statistics::fallbackPhaseMiss, Statistics::fallbackEosMiss};
+		bool solved = false;
+		for (size_t i = 0; i < _fallbackChain.size() && !solved; i++) {
+			try {
+				solved = fallbackFlash(_fallbackChain[i], inputs, value1, value2);
+			} catch (std::exception &e) {
+				if (debug_level > 5)
+					std::cout << format("fallback stage %d failed: %s\n",(int)_fallbackChain[i],e.what());
+			}
+			Statistics::count(this, solved ? hits[_fallbackChain[i]] : misses[_fallbackChain[i]]);
+		}
+		// The error of the generic flash is reported
+		if (!solved)
+			throw;
+	}
+	if (!_fallbackChain.empty() && state->phase() != CoolProp::iphase_twophase) {
+		_lastT = state->T();
+		_lastD = state->rhomass();
+		_lastPhase = state->phase();
 	}
 }
 
+/// One stage of the fallback chain
+/*
+  guesses: Newton iterations on temperature and density for p-h, p-s and h-s
+           inputs, and the CoolProp flash with a density guess for p-T inputs,
+           starting from the last converged single-phase state.
+  phase:   the generic flash with the phase of that state imposed.
+  eos:     the generic flash with the equation of state of a tabular solver,
+           the state of the solver is swapped until the next flash.
+  Returns false if the stage does not apply or fails.
+*/
+bool CoolPropSolver::fallbackFlash(FallbackStage stage, CoolProp::input_pairs inputs, double value1, double value2){
+	if (stage == fallbackGuesses) {
+		if (!isCompressible || !ValidNumber(_lastT) || !ValidNumber(_lastD))
+			return false;
+		if (inputs == CoolProp::PT_INPUTS) {
+			CoolProp::GuessesStructure guesses;
+			guesses.rhomolar = _lastD/_fluidConstants.MM;
+			state->update_with_guesses(inputs, value1, value2, guesses);
+			return ValidNumber(state->rhomass());
+		}
+		CoolProp::parameters key1, key2;
+		switch (inputs) {
+			case CoolProp::HmassP_INPUTS: key1 = CoolProp::iHmass; key2 = CoolProp::iP; break;
+			case CoolProp::PSmass_INPUTS: key1 = CoolProp::iP; key2 = CoolProp::iSmass; break;
+			case CoolProp::HmassSmass_INPUTS: key1 = CoolProp::iHmass; key2 = CoolProp::iSmass; break;
+			default: return false;
+		}
+		// Tolerances of 1e-10, relative to the value or to R*Tc/M and R/M
+		double R_M = 8.314462618/_fluidConstants.MM;
+		double scale1 = (key1 == CoolProp::iP) ? fabs(value1) : (fabs(value1) > R_M*_fluidConstants.Tc ? fabs(value1) : R_M*_fluidConstants.Tc);
+		double scale2 = (key2 == CoolProp::iP) ? fabs(value2) : (fabs(value2) > R_M ? fabs(value2) : R_M);
+		return solveSinglePhase_Td(key1, value1, 1e-10*scale1, key2, value2, 1e-10*scale2, _lastT, _lastD, 50, 0) == solveConverged;
+	}
+	if (stage == fallbackPhase) {
+		if (!isCompressible || _lastPhase == CoolProp::iphase_unknown)
+			return false;
+		state->specify_phase(_lastPhase);
+		try {
+			state->update(inputs, value1, value2);
+		} catch (...) {
+			state->unspecify_phase();
+			throw;
+		}
+		state->unspecify_phase();
+		return ValidNumber(state->rhomass()) && ValidNumber(state->T());
+	}
+	// fallbackEos
+	if (!_tabular)
+		return false;
+	if (!_fallbackState)
+		_fallbackState.reset(newState(_eosBackend));
+	_fallbackState->update(inputs, value1, value2);
+	state.swap(_fallbackState);
+	_fallbackSwapped = true;
+	return true;
+}
+
+/// Swap back the tabular state after an eos fallback stage
+void CoolPropSolver::restoreState(){
+	if (_fallbackSwapped) {
+		state.swap(_fallbackState);
+		_fallbackSwapped = false;
+	}
+}
+
+/// State of an earlier run from the memo store, counted as memo hit or miss
+bool CoolPropSolver::memoLookup(Statistics::Function function, double x1, double x2, int phase, ExternalThermodynamicState *const properties){
+	bool hit = _memo->find(_memoSolver, function, x1, x2, phase, properties);
+	Statistics::count(this, hit ? Statistics::memoHit : Statistics::memoMiss);
+	return hit;
+}
+
+/// Report the error of inputs that failed recently again, without calling CoolProp
+/*
+  Event iterations and line searches retry the same failing inputs several
+  times, and each retry would repeat the failing flash. Returns false if the
+  inputs are not in the failure cache.
+*/
+bool CoolPropSolver::failureCacheLookup(Statistics::Function function, double x1, double x2, int phase){
+	for (size_t i = 0; i < _failureCache.size(); i++) {
+		const FailedState &entry = _failureCache[i];
+		if (entry.function != (int)function || entry.x1 != x1 || entry.x2 != x2 || entry.phase != phase)
+			continue;
+		// Counted before errorMessage, which does not return
+		Statistics::count(this, Statistics::failureCacheHit);
+		std::string message = entry.message;
+		errorMessage((char*)message.c_str());
+		return true;
+	}
+	return false;
+}
+
+/// Keep the inputs of a failed state function in the failure cache and report the error
+void CoolPropSolver::failedState(Statistics::Function function, double x1, double x2, int phase, const char *message){
+	if (!_failureCache.empty()) {
+		Statistics::count(this, Statistics::failureCacheStore);
+		FailedState &entry = _failureCache[_failureCacheNext];
+		entry.function = function;
+		entry.x1 = x1;
+		entry.x2 = x2;
+		entry.phase = phase;
+		entry.message = message;
+		_failureCacheNext = (_failureCacheNext + 1) % (int)_failureCache.size();
+	}
+	errorMessage((char*)message);
+}
+
+/// Validity envelope of the equation of state
+/*
+  Inputs far outside the range of the equation of state only fail after the
+  flash iterations and the exception path, and such calls are frequent in the
+  line searches of the Modelica solvers. The limits of the equation of state are
+  widened by 5%. The enthalpy bounds need flashes and are only computed by
+  computeEnthalpyBounds after the first failed p-h flash.
+*/
+void CoolPropSolver::computeEnvelope(){
+	const double margin = 0.05;
+	_envelope.pmax = NAN;
+	_envelope.Tmin = NAN;
+	_envelope.Tmax = NAN;
+	_envelope.lnp0 = NAN;
+	_envelope.dlnp = NAN;
+	for (int i = 0; i < _nEnvelope; i++) {
+		_envelope.hmin[i] = NAN;
+		_envelope.hmax[i] = NAN;
+	}
+	if (!check_range)
+		return;
+	try {
+		_envelope.Tmin = state->Tmin()*(1 - margin);
+		_envelope.Tmax = state->Tmax()*(1 + margin);
+		if (isCompressible)
+			_envelope.pmax = state->pmax()*(1 + margin);
+	} catch (std::exception &) {
+		return;
+	}
+}
+
+/// Enthalpy bounds of the validity envelope
+/*
+  The bounds h(p, Tmin) and h(p, Tmax) of pure fluids are computed at a few
+  pressures between the triple point and pmax, with a margin of 5% of the
+  enthalpy range. This takes 16 flashes on the auxiliary state, so it is done
+  when a p-h flash first fails instead of in the constructor, later calls
+  outside of the bounds are then rejected before calling CoolProp.
+*/
+void CoolPropSolver::computeEnthalpyBounds(){
+	const double margin = 0.05;
+	_enthalpyBoundsReady = true;
+	if (!check_range || !_isPure || _tabular)
+		return;
+	double Tmin, Tmax, pmin, pmax;
+	try {
+		Tmin = state->Tmin();
+		Tmax = state->Tmax();
+		pmin = state->p_triple();
+		pmax = state->pmax();
+	} catch (std::exception &) {
+		return;
+	}
+	if (!(pmin > 0) || !(pmax > pmin))
+		return;
+	_envelope.lnp0 = log(pmin);
+	_envelope.dlnp = (log(pmax) - _envelope.lnp0)/(_nEnvelope - 1);
+	if (!_auxState)
+		_auxState.reset(newState(_eosBackend));
+	for (int i = 0; i < _nEnvelope; i++) {
+		double p = exp(_envelope.lnp0 + i*_envelope.dlnp);
+		try {
+			_auxState->update(CoolProp::PT_INPUTS, p, Tmin);
+			_envelope.hmin[i] = _auxState->hmass();
+		} catch (std::exception &) {}
+		try {
+			_auxState->update(CoolProp::PT_INPUTS, p, Tmax);
+			_envelope.hmax[i] = _auxState->hmass();
+		} catch (std::exception &) {}
+	}
+	for (int i = 0; i < _nEnvelope; i++) {
+		double dh = margin*(_envelope.hmax[i] - _envelope.hmin[i]);
+		_envelope.hmin[i] -= dh;
+		_envelope.hmax[i] += dh;
+	}
+}
+
+/// Report an input outside the range (min, max] with check_range, NaN limits are not checked
+/*
+  The inputs x1, x2 and phase of the state function are kept in the failure
+  cache like a failed flash. Returns false after the error, the caller returns
+  without calling CoolProp.
+*/
+bool CoolPropSolver::checkRange(Statistics::Function function, double x1, double x2, int phase, const char *name, double value, double min, double max){
+	if (!check_range || (ValidNumber(value) && !(value <= min) && !(value > max)))
+		return true;
+	failedState(function, x1, x2, phase, format("%s: input out of range, %s = %g is outside (%g, %g] for %s",
+		Statistics::functionName(function), name, value, ValidNumber(min) ? min : -HUGE_VAL, ValidNumber(max) ? max : HUGE_VAL, substanceName.c_str()).c_str());
+	return false;
+}
+
+/// Check the enthalpy against the bounds of the envelope at the pressure p
+/*
+  Between two tabulated pressures the wider bounds are used, no bounds are
+  known below the triple point or above pmax.
+*/
+bool CoolPropSolver::checkEnthalpy(Statistics::Function function, double p, double h, int phase){
+	double x = (log(p) - _envelope.lnp0)/_envelope.dlnp;
+	if (!(x >= 0) || !(x <= _nEnvelope - 1))
+		return checkRange(function, p, h, phase, "h", h, NAN, NAN);
+	int i = (int)x;
+	if (i == _nEnvelope - 1)
+		i--;
+	double hmin = (_envelope.hmin[i] < _envelope.hmin[i + 1]) ? _envelope.hmin[i] : _envelope.hmin[i + 1];
+	double hmax = (_envelope.hmax[i] > _envelope.hmax[i + 1]) ? _envelope.hmax[i] : _envelope.hmax[i + 1];
+	// A bound that could not be computed at one of the pressures is not checked
+	if (!ValidNumber(_envelope.hmin[i]) || !ValidNumber(_envelope.hmin[i + 1]))
+		hmin = NAN;
+	if (!ValidNumber(_envelope.hmax[i]) || !ValidNumber(_envelope.hmax[i + 1]))
+		hmax = NAN;
+	return checkRange(function, p, h, phase, "h", h, hmin, hmax);
+}
+
+/// Saturation properties close to critical conditions
+/*
+  The record is needed by calls reaching p or T above the subcritical margin,
+  it is computed on first use instead of in the constructor.
+*/
+const ExternalSaturationProperties &CoolPropSolver::close2Crit(){
+	if (!_close2CritReady) {
+		StatisticsTimer timer(this, Statistics::createSolver_nearCritical);
+		if (debug_level > 5) std::cout << format("Setting near-critical saturation conditions for fluid %s \n",substanceName.c_str());
+		double psat = _satPropsClose2Crit.psat;
+		setSat_p(psat, &_satPropsClose2Crit);
+		_close2CritReady = true;
+	}
+	return _satPropsClose2Crit;
+}
+
+/// Build the near-critical record and the configured spline tables in advance
+void CoolPropSolver::warmUp(){
+	if (!isCompressible)
+		return;
+	close2Crit();
+	if (_isPure && _splineNative && twophase_spline_table > 1) {
+		try {
+			if (twophase_derivsmoothing_xend > 0.0)
+				twoPhaseSpline(_satPropsClose2Crit.psat, twophase_derivsmoothing_xend);
+			if (rho_smoothing_xend > 0.0)
+				twoPhaseSpline(_satPropsClose2Crit.psat, rho_smoothing_xend);
+		} catch (std::exception &e) {
+			if (debug_level > 5) std::cout << format("Closed form spline disabled, using CoolProp: %s\n",e.what());
+			_splineNative = false;
+		}
+	}
+}
+
+/// True if T is above the saturation temperature of the close to crit record
+/*
+  Saturation temperatures at the subcritical margin are very close to the
+  critical temperature, so the record is not needed for lower temperatures.
+*/
+bool CoolPropSolver::aboveClose2Crit_T(double T){
+	return T > 0.95*_fluidConstants.Tc && T > close2Crit().Tsat;
+}
+
 
 void CoolPropSolver::postStateChange(ExternalThermodynamicState *const properties) {
     /// Some common code to avoid pitfalls from incompressibles
@@ -224,26 +819,21 @@ void CoolPropSolver::postStateChange(ExternalThermodynamicState *const propertie
             properties->d = state->rhomass();
             properties->h = state->hmass();
             properties->s = state->smass();
-            if (state->phase() == CoolProp::iphase_twophase){
-                properties->phase = 2;
-            }
-            else{
-                properties->phase = 1;
-            }
-            if ((state->phase() == CoolProp::iphase_twophase) && state->Q() >= 0 && state->Q() <= twophase_derivsmoothing_xend && twophase_derivsmoothing_xend > 0.0)
+            // The phase and the quality are used several times below, query them once
+            bool twophase = (state->phase() == CoolProp::iphase_twophase);
+            double Q = twophase ? state->Q() : -1;
+            properties->phase = twophase ? 2 : 1;
+            if (twophase && Q >= 0 && Q <= twophase_derivsmoothing_xend && twophase_derivsmoothing_xend > 0.0)
             {
                 // Use the smoothed derivatives between a quality of 0 and twophase_derivsmoothing_xend
-                properties->ddph = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass, twophase_derivsmoothing_xend); // [1/(kJ/kg) -- > 1/(J/kg)]
-                properties->ddhp = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP, twophase_derivsmoothing_xend); // [1/kPa -- > 1/Pa]
+                smoothedTwoPhaseDensity(twophase_derivsmoothing_xend, false, properties);
             }
-            else if ((state->phase() == CoolProp::iphase_twophase) && state->Q() >= 0 && state->Q() <= rho_smoothing_xend && rho_smoothing_xend > 0.0)
+            else if (twophase && Q >= 0 && Q <= rho_smoothing_xend && rho_smoothing_xend > 0.0)
             {
                 // Use the smoothed density between a quality of 0 and rho_smoothing_xend
-                properties->ddph = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass, rho_smoothing_xend);
-                properties->ddhp =  state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP, rho_smoothing_xend);
-                properties->d = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iDmass, CoolProp::iDmass, rho_smoothing_xend);
+                smoothedTwoPhaseDensity(rho_smoothing_xend, true, properties);
             }
-            else if (state->phase() == CoolProp::iphase_twophase)
+            else if (twophase)
             {
                 properties->ddhp = state->first_two_phase_deriv(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP);
                 properties->ddph = state->first_two_phase_deriv(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass);
@@ -255,22 +845,23 @@ void CoolPropSolver::postStateChange(ExternalThermodynamicState *const propertie
             }
             // When two phases and EXTTP activated, interpolate some values from the saturated ones.
             // Theses values have generally no physical meaning in this area.
-            if (state->phase() == CoolProp::iphase_twophase){
+            if (twophase){
                 if (extend_twophase)
                 {
-                    // Interpolation
-                    properties->cv = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iCvmass), state->saturated_vapor_keyed_output(CoolProp::iCvmass));
-                    properties->a = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::ispeed_sound), state->saturated_vapor_keyed_output(CoolProp::ispeed_sound));
-                    properties->cp = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iCpmass), state->saturated_vapor_keyed_output(CoolProp::iCpmass));
-                    //properties->kappa = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iisothermal_compressibility), state->saturated_vapor_keyed_output(CoolProp::iisothermal_compressibility));
-                    //properties->beta = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iisobaric_expansion_coefficient), state->saturated_vapor_keyed_output(CoolProp::iisobaric_expansion_coefficient));
+                    // Interpolation between the (cached) saturated end points
+                    const TwoPhaseEndPoints &sat = twoPhaseEndPoints(properties->p);
+                    properties->cv = interp_linear(Q, sat.cv[0], sat.cv[1]);
+                    properties->a = interp_linear(Q, sat.a[0], sat.a[1]);
+                    properties->cp = interp_linear(Q, sat.cp[0], sat.cp[1]);
+                    //properties->kappa = interp_linear(Q, state->saturated_liquid_keyed_output(CoolProp::iisothermal_compressibility), state->saturated_vapor_keyed_output(CoolProp::iisothermal_compressibility));
+                    //properties->beta = interp_linear(Q, state->saturated_liquid_keyed_output(CoolProp::iisobaric_expansion_coefficient), state->saturated_vapor_keyed_output(CoolProp::iisobaric_expansion_coefficient));
                     properties->kappa = NAN;
                     properties->beta = NAN;
 
                     if (calc_transport)
                     {
-                        properties->eta = interp_recip(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iviscosity), state->saturated_vapor_keyed_output(CoolProp::iviscosity));
-                        properties->lambda = interp_linear(state->Q(), state->saturated_liquid_keyed_output(CoolProp::iconductivity), state->saturated_vapor_keyed_output(CoolProp::iconductivity));
+                        properties->eta = interp_recip(Q, sat.eta[0], sat.eta[1]);
+                        properties->lambda = interp_linear(Q, sat.lambda[0], sat.lambda[1]);
                     }
                     else {
                         properties->eta = NAN;
@@ -353,6 +944,207 @@ void CoolPropSolver::postStateChange(ExternalThermodynamicState *const propertie
     }
 }
 
+/// Saturated end-point properties at the pressure of the current two-phase state
+/*
+  For pure fluids the end points only depend on the pressure, so they are kept in
+  a small ring buffer and reused for all two-phase states at the same pressure (or
+  within the relative tolerance twophase_cache_ptol). Mixtures are always evaluated,
+  and so are all states with twophase_endpoint_cache=0.
+*/
+const CoolPropSolver::TwoPhaseEndPoints &CoolPropSolver::twoPhaseEndPoints(double p){
+	bool cached = _isPure && twophase_endpoint_cache;
+	if (cached) {
+		for (int i = 0; i < _nTwoPhaseCache; i++) {
+			if (fabs(_twoPhaseCache[i].p - p) <= twophase_cache_ptol*p) {
+				Statistics::count(this, Statistics::twoPhaseCacheHit);
+				return _twoPhaseCache[i];
+			}
+		}
+		Statistics::count(this, Statistics::twoPhaseCacheMiss);
+	}
+	TwoPhaseEndPoints &sat = _twoPhaseCache[_twoPhaseCacheNext];
+	_twoPhaseCacheNext = (_twoPhaseCacheNext + 1) % _nTwoPhaseCache;
+	sat.cv[0] = state->saturated_liquid_keyed_output(CoolProp::iCvmass);
+	sat.cv[1] = state->saturated_vapor_keyed_output(CoolProp::iCvmass);
+	sat.a[0] = state->saturated_liquid_keyed_output(CoolProp::ispeed_sound);
+	sat.a[1] = state->saturated_vapor_keyed_output(CoolProp::ispeed_sound);
+	sat.cp[0] = state->saturated_liquid_keyed_output(CoolProp::iCpmass);
+	sat.cp[1] = state->saturated_vapor_keyed_output(CoolProp::iCpmass);
+	if (calc_transport) {
+		sat.eta[0] = state->saturated_liquid_keyed_output(CoolProp::iviscosity);
+		sat.eta[1] = state->saturated_vapor_keyed_output(CoolProp::iviscosity);
+		sat.lambda[0] = state->saturated_liquid_keyed_output(CoolProp::iconductivity);
+		sat.lambda[1] = state->saturated_vapor_keyed_output(CoolProp::iconductivity);
+	} else {
+		sat.eta[0] = sat.eta[1] = NAN;
+		sat.lambda[0] = sat.lambda[1] = NAN;
+	}
+	// Only mark the entry as valid once all values are in place
+	sat.p = cached ? p : NAN;
+	return sat;
+}
+
+/// Smoothed density and density derivatives between a quality of 0 and x_end
+/*
+  Evaluates the cubic spline of CoolProp's first_two_phase_deriv_splined in
+  closed form from the per-pressure spline data. If the spline data cannot be
+  computed with the auxiliary state, CoolProp's own implementation is used.
+*/
+void CoolPropSolver::smoothedTwoPhaseDensity(double x_end, bool with_density, ExternalThermodynamicState *const properties){
+	if (_isPure && _splineNative) {
+		try {
+			TwoPhaseSpline sp = twoPhaseSpline(properties->p, x_end);
+			double MM = state->molar_mass();
+			double D = state->hmolar() - sp.hL;
+			double drho_dh = (3*sp.a*D + 2*sp.b)*D + sp.c;
+			double drho_dp = -drho_dh*sp.dhL_dp + ((sp.da_dp*D + sp.db_dp)*D + sp.dc_dp)*D + sp.dd_dp;
+			properties->ddph = drho_dp*MM;     // [mol/m^3/Pa --> kg/m^3/Pa]
+			properties->ddhp = drho_dh*MM*MM;  // [mol^2/m^3/J --> kg^2/m^3/J]
+			if (with_density)
+				properties->d = (((sp.a*D + sp.b)*D + sp.c)*D + sp.d)*MM;
+			return;
+		} catch(std::exception &e) {
+			if (debug_level > 5) std::cout << format("Closed form spline disabled, using CoolProp: %s\n",e.what());
+			_splineNative = false;
+		}
+	}
+	properties->ddph = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass, x_end);
+	properties->ddhp = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP, x_end);
+	if (with_density)
+		properties->d = state->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iDmass, CoolProp::iDmass, x_end);
+}
+
+/// Build the pressure table of the spline data for one end quality
+void CoolPropSolver::buildSplineTable(double x_end, std::vector<TwoPhaseSpline> &table){
+	// Logarithmic spacing between the triple point and the near-critical pressure
+	double lnpmin = log(state->p_triple()*(1.0+_p_eps)), lnpmax = log(_satPropsClose2Crit.psat);
+	table.resize(twophase_spline_table);
+	for (int i = 0; i < twophase_spline_table; i++)
+		computeTwoPhaseSpline(exp(lnpmin + (lnpmax - lnpmin)*i/(twophase_spline_table - 1)), x_end, table[i]);
+	if (debug_level > 5) std::cout << format("Built spline table with %d pressures for x_end=%g\n",twophase_spline_table,x_end);
+}
+
+/// Spline data at pressure p, from the pressure table or the per-pressure cache
+/*
+  The table is only interpolated between its end pressures, outside of them
+  the spline data is computed directly instead of being extrapolated.
+*/
+CoolPropSolver::TwoPhaseSpline CoolPropSolver::twoPhaseSpline(double p, double x_end){
+	std::vector<TwoPhaseSpline> *table = NULL;
+	double pos = NAN;
+	if (twophase_spline_table > 1) {
+		table = &_splineTables[x_end];
+		if (table->empty())
+			buildSplineTable(x_end, *table);
+		double lnp0 = log(table->front().p), lnp1 = log(table->back().p);
+		pos = (log(p) - lnp0)/(lnp1 - lnp0)*(twophase_spline_table - 1);
+	}
+	if (pos >= 0 && pos <= twophase_spline_table - 1) {
+		int i = (int)floor(pos);
+		if (i > twophase_spline_table - 2) i = twophase_spline_table - 2;
+		double w = pos - i;
+		const TwoPhaseSpline &s0 = (*table)[i], &s1 = (*table)[i + 1];
+		// Cubic Hermite interpolation in log(p) of the bubble enthalpy and density,
+		// whose derivatives along the saturation line are tabulated, linear
+		// interpolation of everything else
+		double step = log(s1.p/s0.p), w2 = w*w, w3 = w2*w;
+		double h00 = 2*w3 - 3*w2 + 1, h01 = 3*w2 - 2*w3;
+		double h10 = (w3 - 2*w2 + w)*step*s0.p, h11 = (w3 - w2)*step*s1.p;
+		TwoPhaseSpline sp;
+		sp.p = p;
+		sp.x_end = x_end;
+		sp.hL = h00*s0.hL + h10*s0.dhL_dp + h01*s1.hL + h11*s1.dhL_dp;
+		sp.dhL_dp = s0.dhL_dp + w*(s1.dhL_dp - s0.dhL_dp);
+		sp.a = s0.a + w*(s1.a - s0.a);
+		sp.b = s0.b + w*(s1.b - s0.b);
+		sp.c = s0.c + w*(s1.c - s0.c);
+		sp.d = h00*s0.d + h10*s0.dd_dp + h01*s1.d + h11*s1.dd_dp;
+		sp.da_dp = s0.da_dp + w*(s1.da_dp - s0.da_dp);
+		sp.db_dp = s0.db_dp + w*(s1.db_dp - s0.db_dp);
+		sp.dc_dp = s0.dc_dp + w*(s1.dc_dp - s0.dc_dp);
+		sp.dd_dp = s0.dd_dp + w*(s1.dd_dp - s0.dd_dp);
+		return sp;
+	}
+	for (int i = 0; i < _nTwoPhaseCache; i++) {
+		if (_splineCache[i].p == p && _splineCache[i].x_end == x_end)
+			return _splineCache[i];
+	}
+	TwoPhaseSpline &sp = _splineCache[_splineCacheNext];
+	sp.p = NAN;
+	computeTwoPhaseSpline(p, x_end, sp);
+	_splineCacheNext = (_splineCacheNext + 1) % _nTwoPhaseCache;
+	return sp;
+}
+
+/// Compute the spline data of the smoothed two-phase density at pressure p
+/*
+  Same spline as CoolProp's first_two_phase_deriv_splined: a cubic in D = h - hL
+  between the saturated liquid and the two-phase point at quality x_end, matching
+  the single-phase liquid slope at D = 0 and the two-phase slope at x_end. All
+  data only depends on the pressure, so one VLE solve and two explicit (rho,T)
+  evaluations are needed per pressure instead of per call.
+*/
+void CoolPropSolver::computeTwoPhaseSpline(double p, double x_end, TwoPhaseSpline &spline){
+	if (!_auxState)
+		_auxState.reset(newState(_eosBackend));
+	CoolProp::AbstractState &aux = *_auxState;
+
+	// End point, also provides the saturation data
+	aux.unspecify_phase();
+	aux.update(CoolProp::PQ_INPUTS, p, x_end);
+	double T = aux.T();
+	double rhoL = aux.saturated_liquid_keyed_output(CoolProp::iDmolar);
+	double rhoV = aux.saturated_vapor_keyed_output(CoolProp::iDmolar);
+	double hL = aux.saturated_liquid_keyed_output(CoolProp::iHmolar);
+	double hV = aux.saturated_vapor_keyed_output(CoolProp::iHmolar);
+	double rho_end = aux.rhomolar();
+	double Delta_end = aux.hmolar() - hL;
+	double drho_dh_end = aux.first_two_phase_deriv(CoolProp::iDmolar, CoolProp::iHmolar, CoolProp::iP);
+	double d2rhodhdp_end = aux.second_two_phase_deriv(CoolProp::iDmolar, CoolProp::iHmolar, CoolProp::iP, CoolProp::iP, CoolProp::iHmolar);
+
+	// Clausius-Clapeyron, derivative of T along the saturation line
+	double dTdp_sat = T*(1/rhoV - 1/rhoL)/(hV - hL);
+
+	// Saturated vapour as single phase
+	aux.specify_phase(CoolProp::iphase_gas);
+	aux.update(CoolProp::DmolarT_INPUTS, rhoV, T);
+	double dhV_dp = aux.first_partial_deriv(CoolProp::iHmolar, CoolProp::iP, CoolProp::iT) + aux.first_partial_deriv(CoolProp::iHmolar, CoolProp::iT, CoolProp::iP)*dTdp_sat;
+	double drhoV_dp = aux.first_partial_deriv(CoolProp::iDmolar, CoolProp::iP, CoolProp::iT) + aux.first_partial_deriv(CoolProp::iDmolar, CoolProp::iT, CoolProp::iP)*dTdp_sat;
+
+	// Saturated liquid as single phase
+	aux.specify_phase(CoolProp::iphase_liquid);
+	aux.update(CoolProp::DmolarT_INPUTS, rhoL, T);
+	double dhL_dp = aux.first_partial_deriv(CoolProp::iHmolar, CoolProp::iP, CoolProp::iT) + aux.first_partial_deriv(CoolProp::iHmolar, CoolProp::iT, CoolProp::iP)*dTdp_sat;
+	double drhoL_dp = aux.first_partial_deriv(CoolProp::iDmolar, CoolProp::iP, CoolProp::iT) + aux.first_partial_deriv(CoolProp::iDmolar, CoolProp::iT, CoolProp::iP)*dTdp_sat;
+	double drho_dh_liq = aux.first_partial_deriv(CoolProp::iDmolar, CoolProp::iHmolar, CoolProp::iP);
+	double d2rhodhdp_liq = aux.second_partial_deriv(CoolProp::iDmolar, CoolProp::iHmolar, CoolProp::iP, CoolProp::iP, CoolProp::iHmolar);
+	aux.unspecify_phase();
+
+	// Spline coefficients
+	double Abracket = 2*rhoL - 2*rho_end + Delta_end*(drho_dh_liq + drho_dh_end);
+	spline.a = Abracket/pow(Delta_end, 3);
+	spline.b = 3/pow(Delta_end, 2)*(rho_end - rhoL) - (drho_dh_end + 2*drho_dh_liq)/Delta_end;
+	spline.c = drho_dh_liq;
+	spline.d = rhoL;
+
+	// Their derivatives with respect to pressure at constant enthalpy, the bubble
+	// point moves along the saturation line like in CoolProp
+	double drho_dp_end = pow(rho_end, 2)*(x_end/pow(rhoV, 2)*drhoV_dp + (1 - x_end)/pow(rhoL, 2)*drhoL_dp);
+	double dDelta_end_dp = x_end*(dhV_dp - dhL_dp);
+	double dAbracket_dp = 2*drhoL_dp - 2*drho_dp_end + Delta_end*(d2rhodhdp_liq + d2rhodhdp_end) + dDelta_end_dp*(drho_dh_liq + drho_dh_end);
+	spline.da_dp = dAbracket_dp/pow(Delta_end, 3) - 3*Abracket/pow(Delta_end, 4)*dDelta_end_dp;
+	spline.db_dp = -6/pow(Delta_end, 3)*dDelta_end_dp*(rho_end - rhoL) + 3/pow(Delta_end, 2)*(drho_dp_end - drhoL_dp)
+	             + dDelta_end_dp/pow(Delta_end, 2)*(drho_dh_end + 2*drho_dh_liq) - (d2rhodhdp_end + 2*d2rhodhdp_liq)/Delta_end;
+	spline.dc_dp = d2rhodhdp_liq;
+	spline.dd_dp = drhoL_dp;
+
+	spline.hL = hL;
+	spline.dhL_dp = dhL_dp;
+	spline.x_end = x_end;
+	// Only mark the data as valid once all values are in place
+	spline.p = p;
+}
+
 void fillCritSatState(ExternalSaturationProperties* const properties, const ExternalSaturationProperties &_satPropsClose2Crit) {
 	properties->Tsat = _satPropsClose2Crit.Tsat;  // saturation temperature
 	properties->dTp = _satPropsClose2Crit.dTp;   // derivative of Ts by pressure
@@ -375,13 +1167,6 @@ void fillBubbleState(shared_ptr<CoolProp::AbstractState> state, ExternalSaturati
 	properties->Tsat = state->T(); // At bubble line! (matters for pseudo-pure fluids, potentially wrong for mixtures)
 	properties->dTp = state->first_saturation_deriv(CoolProp::iT, CoolProp::iP); // At bubble line! (matters for pseudo-pure fluids, potentially wrong for mixtures)
 
-	try {
-		//! Surface tension
-		properties->sigma = state->surface_tension();
-	} catch (...) {
-		properties->sigma = NAN;
-	}
-
 	properties->dl = state->rhomass();
 	properties->hl = state->hmass();
 	properties->ddldp = state->first_saturation_deriv(CoolProp::iDmass, CoolProp::iP);
@@ -398,13 +1183,29 @@ void fillDewState(shared_ptr<CoolProp::AbstractState> state, ExternalSaturationP
 }
 
 
+/// Dew line properties from the bubble line VLE solve of a pure fluid
+/*
+  The saturated vapour density is known from the bubble line solve, so the dew
+  state is a single explicit (rho,T) evaluation. The derivatives along the
+  saturation line follow from Clausius-Clapeyron, like in CoolProp.
+*/
+void fillDewStateShared(shared_ptr<CoolProp::AbstractState> satL, shared_ptr<CoolProp::AbstractState> satV, ExternalSaturationProperties* const properties) {
+	satV->update(CoolProp::DmassT_INPUTS, satL->saturated_vapor_keyed_output(CoolProp::iDmass), satL->T());
+	properties->dv = satV->rhomass();
+	properties->hv = satV->hmass();
+	properties->ddvdp = satV->first_partial_deriv(CoolProp::iDmass, CoolProp::iP, CoolProp::iT) + satV->first_partial_deriv(CoolProp::iDmass, CoolProp::iT, CoolProp::iP)*properties->dTp;
+	properties->dhvdp = satV->first_partial_deriv(CoolProp::iHmass, CoolProp::iP, CoolProp::iT) + satV->first_partial_deriv(CoolProp::iHmass, CoolProp::iT, CoolProp::iP)*properties->dTp;
+	properties->sv = satV->smass();
+}
+
+
 void CoolPropSolver::setSat_p(double &p, ExternalSaturationProperties *const properties){
 
 	if (debug_level > 5)
 		std::cout << format("setSat_p(%0.16e)\n",p);
 
 	if (p > _satPropsClose2Crit.psat) { // supercritical conditions
-		fillCritSatState(properties, _satPropsClose2Crit);
+		fillCritSatState(properties, close2Crit());
 	} else {
 	  //this->preStateChange();
 	  try {
@@ -412,24 +1213,21 @@ void CoolPropSolver::setSat_p(double &p, ExternalSaturationProperties *const pro
 		  ** properties->dl = state->saturation_ancillary(CoolProp::iDmass,0,CoolProp::iT,T);                      **
 		  ** properties->dl = state->saturation_ancillary(CoolProp::iDmolar,0,CoolProp::iT,T)/state->molar_mass(); */
 
-		  /* Use of                                                      **
-		  ** state->saturated_liquid_keyed_output(CoolProp::iDmass)      **
-		  ** state->saturated_vapor_keyed_output(CoolProp::iDmass)       **
-		  ** would be interesting but this doesn't solve the derivatives */
+		  if (!_satL)
+			  throw CoolProp::ValueError(format("Saturation properties are not available for fluid %s",substanceName.c_str()));
 
-		  // At bubble line:
-		  state->specify_phase(CoolProp::iphase_liquid);
-		  state->update(CoolProp::PQ_INPUTS, p, 0);
-		  fillBubbleState(state, properties);
+		  // At bubble line, the main state is left untouched:
+		  _satL->update(CoolProp::PQ_INPUTS, p, 0);
+		  fillBubbleState(_satL, properties);
+		  properties->sigma = saturationSigma();
 
 		  // At dew line:
-		  state->specify_phase(CoolProp::iphase_gas);
-		  state->update(CoolProp::PQ_INPUTS, p, 1);
-		  fillDewState(state, properties);
-
-		  // Reset the state (to be sure a new one is created before computing new values):
-		  state->clear();
-          state->unspecify_phase();
+		  if (_sharedVLE) {
+			  fillDewStateShared(_satL, _satV, properties);
+		  } else {
+			  _satV->update(CoolProp::PQ_INPUTS, p, 1);
+			  fillDewState(_satV, properties);
+		  }
 
 	  } catch(std::exception &e) {
 		errorMessage((char*)e.what());
@@ -442,8 +1240,8 @@ void CoolPropSolver::setSat_T(double &T, ExternalSaturationProperties *const pro
 	if (debug_level > 5)
 		std::cout << format("setSat_T(%0.16e)\n",T);
 
-	if (T > _satPropsClose2Crit.Tsat) { // supercritical conditions
-		fillCritSatState(properties, _satPropsClose2Crit);
+	if (aboveClose2Crit_T(T)) { // supercritical conditions
+		fillCritSatState(properties, close2Crit());
 	} else {
 	  //this->preStateChange();
 	  try
@@ -452,19 +1250,21 @@ void CoolPropSolver::setSat_T(double &T, ExternalSaturationProperties *const pro
 		  //properties->dl = state->saturation_ancillary(CoolProp::iDmass,0,CoolProp::iT,T);
 		  //properties->dl = state->saturation_ancillary(CoolProp::iDmolar,0,CoolProp::iT,T)/state->molar_mass();
 
-		  // At bubble line:
-		  state->specify_phase(CoolProp::iphase_liquid);
-		  state->update(CoolProp::QT_INPUTS,0,T);
-		  fillBubbleState(state, properties);
+		  if (!_satL)
+			  throw CoolProp::ValueError(format("Saturation properties are not available for fluid %s",substanceName.c_str()));
 
-		  // At dew line:
-		  state->specify_phase(CoolProp::iphase_gas);
-		  state->update(CoolProp::QT_INPUTS,1,T);
-		  fillDewState(state, properties);
+		  // At bubble line, the main state is left untouched:
+		  _satL->update(CoolProp::QT_INPUTS,0,T);
+		  fillBubbleState(_satL, properties);
+		  properties->sigma = saturationSigma();
 
-		  // Reset the state (to be sure a new one is created before computing new values):
-		  state->clear();
-		  state->unspecify_phase();
+		  // At dew line:
+		  if (_sharedVLE) {
+			  fillDewStateShared(_satL, _satV, properties);
+		  } else {
+			  _satV->update(CoolProp::QT_INPUTS,1,T);
+			  fillDewState(_satV, properties);
+		  }
 
 	  } catch(std::exception &e) {
 		errorMessage((char*)e.what());
@@ -472,8 +1272,81 @@ void CoolPropSolver::setSat_T(double &T, ExternalSaturationProperties *const pro
 	}
 }
 
+/// State on the bubble (Q = 0) or dew (Q = 1) line from saturation properties
+/*
+  The density, enthalpy and entropy are known from the saturation record, so
+  the p-h flash is skipped. The remaining properties come from a single explicit
+  (rho,T) evaluation of satState, whose phase is imposed on the correct side of
+  the dome. On the two-phase side, the derivatives are the two-phase ones at
+  Q = 0 or 1 and the other properties are the saturated values, like in
+  postStateChange. Returns false if the fast path does not apply.
+*/
+bool CoolPropSolver::setSaturatedState(ExternalSaturationProperties *const properties, int Q, int phase, ExternalThermodynamicState *const satProperties){
+	// Smoothed two-phase derivatives and near-critical records use the regular flash
+	if (!_sharedVLE || (phase != 1 && phase != 2) || properties->psat > _satPropsClose2Crit.psat)
+		return false;
+	if (phase == 2 && (twophase_derivsmoothing_xend > 0.0 || rho_smoothing_xend > 0.0))
+		return false;
+
+	shared_ptr<CoolProp::AbstractState> &sat = (Q == 0) ? _satL : _satV;
+	try {
+		sat->update(CoolProp::DmassT_INPUTS, (Q == 0) ? properties->dl : properties->dv, properties->Tsat);
+	} catch(std::exception &e) {
+		if (debug_level > 5) std::cout << format("setSaturatedState failed, using setState_ph: %s\n",e.what());
+		return false;
+	}
+
+	satProperties->p = properties->psat;
+	satProperties->T = properties->Tsat;
+	satProperties->d = (Q == 0) ? properties->dl : properties->dv;
+	satProperties->h = (Q == 0) ? properties->hl : properties->hv;
+	satProperties->s = (Q == 0) ? properties->sl : properties->sv;
+	satProperties->phase = phase;
+	try {
+		if (phase == 1) {
+			satProperties->ddhp = sat->first_partial_deriv(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP);
+			satProperties->ddph = sat->first_partial_deriv(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass);
+			satProperties->kappa = sat->isothermal_compressibility();
+			satProperties->beta = sat->isobaric_expansion_coefficient();
+		} else {
+			// Two-phase derivatives at the end of the dome
+			double dv_dh = (1/properties->dv - 1/properties->dl)/(properties->hv - properties->hl);
+			double dsat_dp = (Q == 0) ? -properties->ddldp/(properties->dl*properties->dl) - dv_dh*properties->dhldp
+			                          : -properties->ddvdp/(properties->dv*properties->dv) - dv_dh*properties->dhvdp;
+			satProperties->ddhp = -satProperties->d*satProperties->d*dv_dh;
+			satProperties->ddph = -satProperties->d*satProperties->d*dsat_dp;
+			satProperties->kappa = NAN;
+			satProperties->beta = NAN;
+		}
+		if (phase == 1 || extend_twophase) {
+			satProperties->cv = sat->cvmass();
+			satProperties->a = sat->speed_sound();
+			satProperties->cp = sat->cpmass();
+			if (calc_transport) {
+				satProperties->eta = sat->viscosity();
+				satProperties->lambda = sat->conductivity();
+			} else {
+				satProperties->eta = NAN;
+				satProperties->lambda = NAN;
+			}
+		} else {
+			satProperties->cv = NAN;
+			satProperties->a = NAN;
+			satProperties->cp = NAN;
+			satProperties->eta = NAN;
+			satProperties->lambda = NAN;
+		}
+	} catch(std::exception &e) {
+		errorMessage((char*)e.what());
+	}
+	return true;
+}
+
 /// Set bubble state
 void CoolPropSolver::setBubbleState(ExternalSaturationProperties *const properties, int phase, ExternalThermodynamicState *const bubbleProperties){
+	if (setSaturatedState(properties, 0, phase, bubbleProperties))
+		return;
+
 	double hl;
 	if (phase == 0)
 		hl = properties->hl;
@@ -487,6 +1360,9 @@ void CoolPropSolver::setBubbleState(ExternalSaturationProperties *const properti
 
 /// Set dew state
 void CoolPropSolver::setDewState(ExternalSaturationProperties *const properties, int phase, ExternalThermodynamicState *const dewProperties){
+	if (setSaturatedState(properties, 1, phase, dewProperties))
+		return;
+
 	double hv;
 	if (phase == 0)
 		hv = properties->hv;
@@ -498,17 +1374,121 @@ void CoolPropSolver::setDewState(ExternalSaturationProperties *const properties,
 	setState_ph(properties->psat, hv, phase, dewProperties);
 }
 
+/// Approximate p-h state from a cached state within the relative tolerance taylor_cache_rtol
+/*
+  Finite-difference Jacobians and step size controllers probe states that
+  differ from a recent one by tiny perturbations. The density, temperature
+  and entropy are extrapolated to first order from the cached state, with
+  (dT/dh)_p = 1/cp, (dT/dp)_h = (T*beta - 1)/(d*cp), (ds/dh)_p = 1/T and
+  (ds/dp)_h = -1/(d*T), the other properties are kept. The density of
+  incompressibles only depends on temperature, their beta = -ddhp*cp/d.
+*/
+bool CoolPropSolver::taylorCacheLookup(double p, double h, int phase, ExternalThermodynamicState *const properties){
+	for (int i = 0; i < _nTaylorCache; i++) {
+		const TaylorEntry &entry = _taylorCache[i];
+		double dp = p - entry.p, dh = h - entry.h;
+		if (entry.phase != phase || !(fabs(dp) <= taylor_cache_rtol*fabs(entry.p)) || !(fabs(dh) <= taylor_cache_rtol*fabs(entry.h)))
+			continue;
+		extrapolateState(entry.state, p, h, properties);
+		return true;
+	}
+	return false;
+}
+
+/// First order extrapolation of a single-phase state to the pressure p and enthalpy h
+void CoolPropSolver::extrapolateState(const ExternalThermodynamicState &s0, double p, double h, ExternalThermodynamicState *const properties){
+	double dp = p - s0.p, dh = h - s0.h;
+	*properties = s0;
+	properties->p = p;
+	properties->h = h;
+	properties->d = s0.d + s0.ddph*dp + s0.ddhp*dh;
+	double beta = ValidNumber(s0.beta) ? s0.beta : -s0.ddhp*s0.cp/s0.d;
+	properties->T = s0.T + dh/s0.cp + dp*(s0.T*beta - 1)/(s0.d*s0.cp);
+	properties->s = s0.s + dh/s0.T - dp/(s0.d*s0.T);
+}
+
+/// Keep a computed p-h state for the approximate cache
+/*
+  Only single-phase states of pure fluids and incompressibles with all the
+  derivatives are kept. States close to the critical point, or closer to
+  the bubble or dew line than ten times the tolerance, are not kept, since
+  a perturbation could cross the phase boundary. The saturation states are
+  only computed if the temperature is within 1% of the ancillary saturation
+  temperature plus that margin, with the heat of vaporization bounded by
+  15 R*Tc/M, or if the backend has no ancillaries.
+*/
+void CoolPropSolver::taylorCacheInsert(double p, double h, int phase, const ExternalThermodynamicState *properties){
+	if (properties->phase != 1 || (isCompressible && !_isPure))
+		return;
+	if (!ValidNumber(properties->cp) || (isCompressible && !ValidNumber(properties->beta)) || !ValidNumber(properties->ddph) || !ValidNumber(properties->ddhp)
+		|| !(properties->cp > 0) || !(properties->d > 0) || !(properties->T > 0))
+		return;
+	if (isCompressible) {
+		const FluidConstants &crit = _fluidConstants;
+		if (fabs(p - crit.pc) < 0.02*crit.pc && fabs(properties->T - crit.Tc) < 0.02*crit.Tc)
+			return;
+		if (p < crit.pc) {
+			try {
+				if (!_auxState)
+					_auxState.reset(newState(_eosBackend));
+				double Tsat = NAN;
+				try {
+					Tsat = _auxState->saturation_ancillary(CoolProp::iT, 0, CoolProp::iP, p);
+				} catch (std::exception &) {
+				}
+				double R_M = 8.314462618/crit.MM;
+				if (!(fabs(properties->T - Tsat) > 0.01*Tsat + 10*taylor_cache_rtol*(fabs(h) + 15*R_M*crit.Tc)/properties->cp)) {
+					_auxState->update(CoolProp::PQ_INPUTS, p, 0);
+					double hl = _auxState->saturated_liquid_keyed_output(CoolProp::iHmass);
+					double hv = _auxState->saturated_vapor_keyed_output(CoolProp::iHmass);
+					double margin = 10*taylor_cache_rtol*(fabs(h) + fabs(hv - hl));
+					if (!(fabs(h - hl) > margin && fabs(h - hv) > margin))
+						return;
+				}
+			} catch (std::exception &) {
+				return;
+			}
+		}
+	}
+	TaylorEntry &entry = _taylorCache[_taylorCacheNext];
+	entry.p = p;
+	entry.h = h;
+	entry.phase = phase;
+	entry.state = *properties;
+	_taylorCacheNext = (_taylorCacheNext + 1) % _nTaylorCache;
+}
+
 // Note: the phase input is currently not supported
 void CoolPropSolver::setState_ph(double &p, double &h, int &phase, ExternalThermodynamicState *const properties){
 
 	if (debug_level > 5)
 		std::cout << format("setState_ph(p=%0.16e,h=%0.16e)\n",p,h);
 
+	if (!_failureCache.empty() && failureCacheLookup(Statistics::setState_ph, p, h, phase))
+		return;
+	if (!checkRange(Statistics::setState_ph, p, h, phase, "p", p, 0, _envelope.pmax) || !checkEnthalpy(Statistics::setState_ph, p, h, phase))
+		return;
+
+	if (taylor_cache_rtol > 0.0) {
+		bool hit = taylorCacheLookup(p, h, phase, properties);
+		Statistics::count(this, hit ? Statistics::taylorHit : Statistics::taylorMiss);
+		if (hit)
+			return;
+	}
+	if (_memo && memoLookup(Statistics::setState_ph, p, h, phase, properties))
+		return;
+
 	//this->preStateChange();
 
 	try{
-		// Update the internal variables in the state instance
-		state->update(CoolProp::HmassP_INPUTS,h,p);
+		// Update the internal variables in the state instance, near the critical
+		// pressure the approximate result of the bounded flash is already set
+		if (boundedPressure(p)) {
+			if (!boundedFlash(CoolProp::iHmass, _boundedPH, p, h, properties))
+				return;
+		}
+		else
+			flash(CoolProp::HmassP_INPUTS,h,p);
 
 		if (!ValidNumber(state->rhomass()) || !ValidNumber(state->T()))
 		{
@@ -517,10 +1497,19 @@ void CoolPropSolver::setState_ph(double &p, double &h, int &phase, ExternalTherm
 
 		// Set the values in the output structure
 		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, Statistics::setState_ph, p, h, phase, properties);
+		if (taylor_cache_rtol > 0.0)
+			taylorCacheInsert(p, h, phase, properties);
 	}
 	catch(std::exception &e)
 	{
-		errorMessage((char*)e.what());
+		if (!_enthalpyBoundsReady) {
+			computeEnthalpyBounds();
+			if (!checkEnthalpy(Statistics::setState_ph, p, h, phase))
+				return;
+		}
+		failedState(Statistics::setState_ph, p, h, phase, e.what());
 	}
 }
 
@@ -529,18 +1518,28 @@ void CoolPropSolver::setState_pT(double &p, double &T, ExternalThermodynamicStat
 	if (debug_level > 5)
 		std::cout << format("setState_pT(p=%0.16e,T=%0.16e)\n",p,T);
 
+	if (!_failureCache.empty() && failureCacheLookup(Statistics::setState_pT, p, T, 0))
+		return;
+	if (!checkRange(Statistics::setState_pT, p, T, 0, "p", p, 0, _envelope.pmax) || !checkRange(Statistics::setState_pT, p, T, 0, "T", T, _envelope.Tmin, _envelope.Tmax))
+		return;
+
+	if (_memo && memoLookup(Statistics::setState_pT, p, T, 0, properties))
+		return;
+
 	//this->preStateChange();
 
 	try{
 		// Update the internal variables in the state instance
-		state->update(CoolProp::PT_INPUTS,p,T);
+		flash(CoolProp::PT_INPUTS,p,T);
 
 		// Set the values in the output structure
 		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, Statistics::setState_pT, p, T, 0, properties);
 	}
 	catch(std::exception &e)
 	{
-		errorMessage((char*)e.what());
+		failedState(Statistics::setState_pT, p, T, 0, e.what());
 	}
 }
 
@@ -551,19 +1550,29 @@ void CoolPropSolver::setState_dT(double &d, double &T, int &phase, ExternalTherm
 	if (debug_level > 5)
 		std::cout << format("setState_dT(d=%0.16e,T=%0.16e)\n",d,T);
 
+	if (!_failureCache.empty() && failureCacheLookup(Statistics::setState_dT, d, T, phase))
+		return;
+	if (!checkRange(Statistics::setState_dT, d, T, phase, "d", d, 0, NAN) || !checkRange(Statistics::setState_dT, d, T, phase, "T", T, _envelope.Tmin, _envelope.Tmax))
+		return;
+
+	if (_memo && memoLookup(Statistics::setState_dT, d, T, phase, properties))
+		return;
+
 	//this->preStateChange();
 
 	try{
 
 		// Update the internal variables in the state instance
-		state->update(CoolProp::DmassT_INPUTS,d,T);
+		flash(CoolProp::DmassT_INPUTS,d,T);
 
 		// Set the values in the output structure
 		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, Statistics::setState_dT, d, T, phase, properties);
 	}
 	catch(std::exception &e)
 	{
-		errorMessage((char*)e.what());
+		failedState(Statistics::setState_dT, d, T, phase, e.what());
 	}
 }
 
@@ -573,18 +1582,36 @@ void CoolPropSolver::setState_ps(double &p, double &s, int &phase, ExternalTherm
 	if (debug_level > 5)
 		std::cout << format("setState_ps(p=%0.16e,s=%0.16e)\n",p,s);
 
+	if (!_failureCache.empty() && failureCacheLookup(Statistics::setState_ps, p, s, phase))
+		return;
+	if (!checkRange(Statistics::setState_ps, p, s, phase, "p", p, 0, _envelope.pmax) || !checkRange(Statistics::setState_ps, p, s, phase, "s", s, NAN, NAN))
+		return;
+
+	if (_memo && memoLookup(Statistics::setState_ps, p, s, phase, properties))
+		return;
+
 	//this->preStateChange();
 
 	try{
-		// Update the internal variables in the state instance
-		state->update(CoolProp::PSmass_INPUTS,p,s);
+		// Update the internal variables in the state instance, near the critical
+		// pressure the approximate result of the bounded flash is already set
+		if (boundedPressure(p)) {
+			if (!boundedFlash(CoolProp::iSmass, _boundedPS, p, s, properties))
+				return;
+		}
+		else if (_warmStartPS.slots.empty())
+			flash(CoolProp::PSmass_INPUTS,p,s);
+		else
+			updateWarmStart(CoolProp::PSmass_INPUTS, _warmStartPS, CoolProp::iP, p, CoolProp::iSmass, s);
 
 		// Set the values in the output structure
 		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, Statistics::setState_ps, p, s, phase, properties);
 	}
 	catch(std::exception &e)
 	{
-		errorMessage((char*)e.what());
+		failedState(Statistics::setState_ps, p, s, phase, e.what());
 	}
 }
 
@@ -595,18 +1622,501 @@ void CoolPropSolver::setState_hs(double &h, double &s, int &phase, ExternalTherm
 	if (debug_level > 5)
 		std::cout << format("setState_hs(h=%0.16e,s=%0.16e)\n",h,s);
 
+	if (!_failureCache.empty() && failureCacheLookup(Statistics::setState_hs, h, s, phase))
+		return;
+	if (!checkRange(Statistics::setState_hs, h, s, phase, "h", h, NAN, NAN) || !checkRange(Statistics::setState_hs, h, s, phase, "s", s, NAN, NAN))
+		return;
+
+	if (_memo && memoLookup(Statistics::setState_hs, h, s, phase, properties))
+		return;
+
 	//this->preStateChange();
 
 	try{
 		// Update the internal variables in the state instance
-		state->update(CoolProp::HmassSmass_INPUTS,h,s);
+		if (_warmStartHS.slots.empty())
+			flash(CoolProp::HmassSmass_INPUTS,h,s);
+		else
+			updateWarmStart(CoolProp::HmassSmass_INPUTS, _warmStartHS, CoolProp::iHmass, h, CoolProp::iSmass, s);
 
 		// Set the values in the output structure
 		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, Statistics::setState_hs, h, s, phase, properties);
 	}
 	catch(std::exception &e)
 	{
-		errorMessage((char*)e.what());
+		failedState(Statistics::setState_hs, h, s, phase, e.what());
+	}
+}
+
+/// Clear a warm-start index and set its grid
+void CoolPropSolver::initWarmStartIndex(WarmStartIndex &index, int nSlots, bool log1, double width1, double width2){
+	WarmStartEntry empty = {NAN, NAN, NAN, NAN, false};
+	index.slots.assign(nSlots, empty);
+	index.log1 = log1;
+	index.width1 = width1;
+	index.width2 = width2;
+}
+
+/// Slot of a grid cell in a warm-start index
+static size_t warmStartSlot(double c1, double c2, size_t nSlots){
+	unsigned long long hash = (unsigned long long)(long long)c1*73856093ULL ^ (unsigned long long)(long long)c2*19349663ULL;
+	return (size_t)(hash % nSlots);
+}
+
+/// Temperature and density of the nearest stored state
+/*
+  The index keeps one state per grid cell, the cell of the inputs and the
+  cells within radius of it, its eight neighbours by default, are searched.
+  Returns false if none of them holds a state.
+*/
+bool CoolPropSolver::warmStartLookup(const WarmStartIndex &index, double x1, double x2, double &T, double &d, int radius) const{
+	double u1 = (index.log1 ? log(x1) : x1)/index.width1;
+	double u2 = x2/index.width2;
+	if (!ValidNumber(u1) || !ValidNumber(u2))
+		return false;
+	double c1 = floor(u1), c2 = floor(u2);
+	double distance = HUGE_VAL;
+	for (int i = -radius; i <= radius; i++) {
+		for (int j = -radius; j <= radius; j++) {
+			const WarmStartEntry &entry = index.slots[warmStartSlot(c1 + i, c2 + j, index.slots.size())];
+			// The slot may hold a state of another cell with the same hash, or only the slow flag
+			if (floor(entry.u1) != c1 + i || floor(entry.u2) != c2 + j || !ValidNumber(entry.T))
+				continue;
+			double entryDistance = (entry.u1 - u1)*(entry.u1 - u1) + (entry.u2 - u2)*(entry.u2 - u2);
+			if (entryDistance < distance) {
+				distance = entryDistance;
+				T = entry.T;
+				d = entry.d;
+			}
+		}
+	}
+	return distance < HUGE_VAL;
+}
+
+/// Keep the current single-phase state in a warm-start index
+void CoolPropSolver::warmStartInsert(WarmStartIndex &index, double x1, double x2){
+	if (state->phase() == CoolProp::iphase_twophase || !ValidNumber(state->T()) || !(state->rhomass() > 0))
+		return;
+	WarmStartEntry entry;
+	entry.u1 = (index.log1 ? log(x1) : x1)/index.width1;
+	entry.u2 = x2/index.width2;
+	entry.T = state->T();
+	entry.d = state->rhomass();
+	entry.slow = false;
+	if (!ValidNumber(entry.u1) || !ValidNumber(entry.u2))
+		return;
+	WarmStartEntry &slot = index.slots[warmStartSlot(floor(entry.u1), floor(entry.u2), index.slots.size())];
+	// The slow flag stays with the cell
+	entry.slow = slot.slow && floor(slot.u1) == floor(entry.u1) && floor(slot.u2) == floor(entry.u2);
+	slot = entry;
+}
+
+/// Flag the cell of the inputs, the generic flash was slow or failed there
+void CoolPropSolver::warmStartMarkSlow(WarmStartIndex &index, double x1, double x2){
+	double u1 = (index.log1 ? log(x1) : x1)/index.width1;
+	double u2 = x2/index.width2;
+	if (!ValidNumber(u1) || !ValidNumber(u2))
+		return;
+	WarmStartEntry &slot = index.slots[warmStartSlot(floor(u1), floor(u2), index.slots.size())];
+	if (floor(slot.u1) != floor(u1) || floor(slot.u2) != floor(u2)) {
+		WarmStartEntry entry = {u1, u2, NAN, NAN, false};
+		slot = entry;
+	}
+	slot.slow = true;
+}
+
+/// The generic flash was slow or failed in the cell of the inputs
+bool CoolPropSolver::warmStartSlow(const WarmStartIndex &index, double x1, double x2) const{
+	double u1 = (index.log1 ? log(x1) : x1)/index.width1;
+	double u2 = x2/index.width2;
+	if (!ValidNumber(u1) || !ValidNumber(u2))
+		return false;
+	const WarmStartEntry &slot = index.slots[warmStartSlot(floor(u1), floor(u2), index.slots.size())];
+	return slot.slow && floor(slot.u1) == floor(u1) && floor(slot.u2) == floor(u2);
+}
+
+/// Single-phase solution for two inputs by Newton iterations on temperature and density
+/*
+  Each iteration is an explicit density-temperature evaluation of the equation
+  of state. Returns solveOverBudget if the iteration does not converge within
+  maxIter steps or maxTime seconds (0 for no limit), the state is then the last
+  iterate. Returns solveFailed if the iteration reaches the two-phase region or
+  breaks down, the state is then undefined. The number of evaluations is added
+  to evaluations if given.
+*/
+CoolPropSolver::SolveResult CoolPropSolver::solveSinglePhase_Td(CoolProp::parameters key1, double x1, double tol1, CoolProp::parameters key2, double x2, double tol2, double T, double d, int maxIter, double maxTime, int *evaluations){
+	try{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double Tmin = state->Tmin(), Tmax = state->Tmax();
+		for (int iter = 0; iter < maxIter; iter++){
+			if (evaluations)
+				(*evaluations)++;
+			state->update(CoolProp::DmassT_INPUTS, d, T);
+			if (state->phase() == CoolProp::iphase_twophase)
+				return solveFailed;
+			double r1 = state->keyed_output(key1) - x1;
+			double r2 = state->keyed_output(key2) - x2;
+			if (fabs(r1) <= tol1 && fabs(r2) <= tol2) {
+				if (debug_level > 5)
+					std::cout << format("solveSinglePhase_Td: %d iterations, T=%0.16e, d=%0.16e\n",iter,T,d);
+				return solveConverged;
+			}
+			// The last iterate is kept as the state if the budget is exceeded
+			if (iter == maxIter - 1 || (maxTime > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > maxTime))
+				return solveOverBudget;
+			double a = state->first_partial_deriv(key1, CoolProp::iT, CoolProp::iDmass);
+			double b = state->first_partial_deriv(key1, CoolProp::iDmass, CoolProp::iT);
+			double c = state->first_partial_deriv(key2, CoolProp::iT, CoolProp::iDmass);
+			double e = state->first_partial_deriv(key2, CoolProp::iDmass, CoolProp::iT);
+			double det = a*e - b*c;
+			double dT = -(e*r1 - b*r2)/det;
+			double dd = -(a*r2 - c*r1)/det;
+			if (!ValidNumber(dT) || !ValidNumber(dd))
+				return solveFailed;
+			// Damp steps that leave the range of the equation of state
+			double lambda = 1;
+			while (lambda > 1e-3 && (T + lambda*dT < Tmin || T + lambda*dT > Tmax || d + lambda*dd < 0.2*d))
+				lambda *= 0.5;
+			T += lambda*dT;
+			d += lambda*dd;
+		}
+		return solveOverBudget;
+	}
+	catch(std::exception &e)
+	{
+		if (debug_level > 5)
+			std::cout << format("solveSinglePhase_Td failed: %s\n",e.what());
+		return solveFailed;
+	}
+}
+
+/// Single-phase solution on the isobar p by safeguarded Newton iterations on temperature
+/*
+  Each iteration is a p-T evaluation of the equation of state. The input x2,
+  enthalpy or entropy, increases with the temperature along the isobar, so the
+  Newton steps are kept inside a bracket that starts at the temperature range
+  of the equation of state and falls back to bisection. Returns like
+  solveSinglePhase_Td.
+*/
+CoolPropSolver::SolveResult CoolPropSolver::solveIsobar_T(CoolProp::parameters key2, double p, double x2, double tol2, int maxIter, double maxTime, int *evaluations){
+	try{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double Tlo = state->Tmin(), Thi = state->Tmax();
+		// Start above the critical point, where the p-T evaluation is singular
+		double T = (1.1*_fluidConstants.Tc > Tlo && 1.1*_fluidConstants.Tc < Thi) ? 1.1*_fluidConstants.Tc : 0.5*(Tlo + Thi);
+		for (int iter = 0; iter < maxIter; iter++){
+			if (evaluations)
+				(*evaluations)++;
+			try{
+				state->update(CoolProp::PT_INPUTS, p, T);
+			}
+			catch(std::exception &e)
+			{
+				// Below the melting line or at the critical point, bisect away from it
+				if (T < _fluidConstants.Tc)
+					Tlo = T;
+				else
+					Thi = T;
+				T = 0.5*(Tlo + Thi);
+				continue;
+			}
+			double r = state->keyed_output(key2) - x2;
+			if (fabs(r) <= tol2) {
+				if (debug_level > 5)
+					std::cout << format("solveIsobar_T: %d iterations, T=%0.16e\n",iter,T);
+				return solveConverged;
+			}
+			if (iter == maxIter - 1 || (maxTime > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > maxTime))
+				return solveOverBudget;
+			if (r > 0)
+				Thi = T;
+			else
+				Tlo = T;
+			double Tnew = T - r/state->first_partial_deriv(key2, CoolProp::iT, CoolProp::iP);
+			T = (Tnew > Tlo && Tnew < Thi) ? Tnew : 0.5*(Tlo + Thi);
+		}
+		return solveOverBudget;
+	}
+	catch(std::exception &e)
+	{
+		if (debug_level > 5)
+			std::cout << format("solveIsobar_T failed: %s\n",e.what());
+		return solveFailed;
+	}
+}
+
+/// Flash warm-started from the nearest state of an index
+/*
+  Calls in random order, from the initialization or from many cells of a
+  model, gain nothing from the previous call. The Newton iteration starts
+  from the temperature and density of the nearest converged state instead,
+  the generic CoolProp flash is used if there is none or the iteration fails.
+*/
+void CoolPropSolver::updateWarmStart(CoolProp::input_pairs inputs, WarmStartIndex &index, CoolProp::parameters key1, double x1, CoolProp::parameters key2, double x2){
+	double T, d;
+	SolveResult result = solveFailed;
+	if (warmStartLookup(index, x1, x2, T, d)) {
+		// Tolerances of 1e-10, relative to the value or to the grid scale of the input
+		double scale1 = (index.log1 || fabs(x1) > index.width1) ? fabs(x1) : index.width1;
+		double scale2 = (fabs(x2) > index.width2) ? fabs(x2) : index.width2;
+		result = solveSinglePhase_Td(key1, x1, 1e-10*scale1, key2, x2, 1e-10*scale2, T, d, 12, 0);
+	}
+	if (result != solveConverged)
+		flash(inputs, x1, x2);
+	warmStartInsert(index, x1, x2);
+}
+
+/// The p-h and p-s flashes at this pressure are bounded by the flash budget
+bool CoolPropSolver::boundedPressure(double p) const{
+	return flash_max_iter > 0 && !_boundedPH.slots.empty() && p > 0.7*_fluidConstants.pc && p < 1.5*_fluidConstants.pc;
+}
+
+/// p-h or p-s flash near the critical pressure within the flash budget
+/*
+  Near the critical pressure, the generic p-h and p-s flashes occasionally take
+  orders of magnitude longer than usual or fail. The generic flash is tried
+  first and counts as one evaluation; where it failed or exceeded
+  flash_max_time, the cell of the inputs is flagged and later calls in it skip
+  it. The remaining budget goes to the retry:
+  - Newton iterations on temperature and density from the nearest converged
+    state of the index, if any, for at most 12 steps;
+  - below the critical pressure, the inputs are located with respect to the
+    saturation states at p: the two-phase state follows from the quality,
+    otherwise the iteration is restarted from the saturated liquid or vapour;
+  - safeguarded Newton iterations on temperature along the isobar.
+  Every CoolProp update counts against flash_max_iter, flash_max_time is
+  checked between the updates.
+
+  When the budget is exceeded, the call fails, or with flash_fallback=approximate
+  the state of the nearest converged neighbour, or of the last converged state
+  if there is none within eight cells, is extrapolated to the inputs to first
+  order and a warning gives the distance of the extrapolation. Returns
+  true if the state holds the solution, false if properties holds the
+  approximation, which must not be cached.
+*/
+bool CoolPropSolver::boundedFlash(CoolProp::parameters key2, WarmStartIndex &index, double p, double x2, ExternalThermodynamicState *const properties){
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	restoreState();
+	double elapsed = 0;
+	int used = 0;
+	SolveResult result = solveFailed;
+	if (!warmStartSlow(index, p, x2)) {
+		used++;
+		try {
+			if (key2 == CoolProp::iHmass)
+				state->update(CoolProp::HmassP_INPUTS, x2, p);
+			else
+				state->update(CoolProp::PSmass_INPUTS, p, x2);
+			if (ValidNumber(state->rhomass()) && ValidNumber(state->T()))
+				result = solveConverged;
+		} catch (std::exception &e) {
+			if (debug_level > 5)
+				std::cout << format("boundedFlash: generic flash at p=%g failed: %s\n",p,e.what());
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (result != solveConverged || (flash_max_time > 0 && elapsed > flash_max_time))
+			warmStartMarkSlow(index, p, x2);
+	}
+
+	double tol1 = 1e-10*p, tol2 = 1e-10*((fabs(x2) > index.width2) ? fabs(x2) : index.width2);
+	double T0 = NAN, d0 = NAN;
+	bool neighbour = warmStartLookup(index, p, x2, T0, d0);
+	if (result == solveFailed && neighbour && used < flash_max_iter && (flash_max_time == 0 || elapsed < flash_max_time)) {
+		result = solveSinglePhase_Td(CoolProp::iP, p, tol1, key2, x2, tol2, T0, d0, (flash_max_iter - used < 12) ? flash_max_iter - used : 12, (flash_max_time > 0) ? flash_max_time - elapsed : 0, &used);
+		// The later stages are tried if the neighbour was too far
+		if (result == solveOverBudget && used < flash_max_iter)
+			result = solveFailed;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	if (result == solveFailed && p < _fluidConstants.pc && used < flash_max_iter && (flash_max_time == 0 || elapsed < flash_max_time)) {
+		// Locate the inputs with respect to the saturation states
+		try {
+			if (!_auxState)
+				_auxState.reset(newState(_eosBackend));
+			used++;
+			_auxState->update(CoolProp::PQ_INPUTS, p, 0);
+			double xL = _auxState->saturated_liquid_keyed_output(key2);
+			double xV = _auxState->saturated_vapor_keyed_output(key2);
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (used >= flash_max_iter || (flash_max_time > 0 && elapsed >= flash_max_time))
+				result = solveOverBudget;
+			else if (x2 >= xL && x2 <= xV) {
+				used++;
+				state->update(CoolProp::PQ_INPUTS, p, (x2 - xL)/(xV - xL));
+				result = solveConverged;
+			} else {
+				double T = _auxState->T();
+				double d = (x2 < xL) ? _auxState->saturated_liquid_keyed_output(CoolProp::iDmass) : _auxState->saturated_vapor_keyed_output(CoolProp::iDmass);
+				result = solveSinglePhase_Td(CoolProp::iP, p, tol1, key2, x2, tol2, T, d, flash_max_iter - used, (flash_max_time > 0) ? flash_max_time - elapsed : 0, &used);
+			}
+		} catch (std::exception &e) {
+			if (debug_level > 5)
+				std::cout << format("boundedFlash: saturation at p=%g failed: %s\n",p,e.what());
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	if (result == solveFailed && used < flash_max_iter && (flash_max_time == 0 || elapsed < flash_max_time))
+		result = solveIsobar_T(key2, p, x2, tol2, flash_max_iter - used, (flash_max_time > 0) ? flash_max_time - elapsed : 0, &used);
+
+	// A slow generic flash still gives the exact state, the budget hit is counted
+	if (result == solveConverged) {
+		if (state->phase() != CoolProp::iphase_twophase) {
+			warmStartInsert(index, p, x2);
+			_lastT = state->T();
+			_lastD = state->rhomass();
+			_lastPhase = state->phase();
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (flash_max_time > 0 && elapsed > flash_max_time)
+			Statistics::count(this, Statistics::flashBudgetHit);
+		return true;
+	}
+
+	Statistics::count(this, Statistics::flashBudgetHit);
+	const char *name = (key2 == CoolProp::iHmass) ? "h" : "s";
+	if (!flash_fallback_approximate)
+		throw CoolProp::ValueError(format("flash budget of %d iterations and %g s exceeded for p = %g, %s = %g",flash_max_iter,flash_max_time,p,name,x2));
+	// The extrapolation may also start from a state a few cells away, or from
+	// the last converged single-phase state
+	if (!neighbour && !warmStartLookup(index, p, x2, T0, d0, 8)) {
+		T0 = _lastT;
+		d0 = _lastD;
+	}
+	if (!ValidNumber(T0) || !ValidNumber(d0))
+		throw CoolProp::ValueError(format("flash budget of %d iterations and %g s exceeded for p = %g, %s = %g, no converged state nearby to extrapolate from",flash_max_iter,flash_max_time,p,name,x2));
+
+	// First order extrapolation from the neighbour, dh = T*ds + dp/d for p-s inputs
+	state->update(CoolProp::DmassT_INPUTS, d0, T0);
+	ExternalThermodynamicState s0;
+	this->postStateChange(&s0);
+	double h = (key2 == CoolProp::iHmass) ? x2 : s0.h + s0.T*(x2 - s0.s) + (p - s0.p)/s0.d;
+	extrapolateState(s0, p, h, properties);
+	Statistics::count(this, Statistics::flashApproximated);
+	warningMessage((char*)format("flash budget of %d iterations and %g s exceeded for p = %g, %s = %g, the state is extrapolated from p = %g, %s = %g",
+		flash_max_iter,flash_max_time,p,name,x2,s0.p,name,(key2 == CoolProp::iHmass) ? s0.h : s0.s).c_str());
+	return false;
+}
+
+// Note: phase = 2 enables the native two-phase branch
+void CoolPropSolver::setState_du(double &d, double &u, int &phase, ExternalThermodynamicState *const properties){
+
+	if (debug_level > 5)
+		std::cout << format("setState_du(d=%0.16e,u=%0.16e)\n",d,u);
+
+	setState_dx(CoolProp::DmassUmass_INPUTS, CoolProp::iUmass, d, u, phase, properties);
+}
+
+// Note: phase = 2 enables the native two-phase branch
+void CoolPropSolver::setState_dh(double &d, double &h, int &phase, ExternalThermodynamicState *const properties){
+
+	if (debug_level > 5)
+		std::cout << format("setState_dh(d=%0.16e,h=%0.16e)\n",d,h);
+
+	setState_dx(CoolProp::DmassHmass_INPUTS, CoolProp::iHmass, d, h, phase, properties);
+}
+
+/// Common implementation of the density-based state functions
+/*
+  The native two-phase branch is tried first if the caller flags the state as
+  two-phase with phase = 2. If it does not converge to a point inside the dome,
+  the generic CoolProp flash is used, as for phase = 0 and phase = 1. The
+  result only depends on the inputs, not on earlier calls.
+*/
+void CoolPropSolver::setState_dx(CoolProp::input_pairs inputs, CoolProp::parameters x_key, double &d, double &x, int &phase, ExternalThermodynamicState *const properties){
+
+	Statistics::Function function = (x_key == CoolProp::iUmass) ? Statistics::setState_du : Statistics::setState_dh;
+	if (!_failureCache.empty() && failureCacheLookup(function, d, x, phase))
+		return;
+	if (!checkRange(function, d, x, phase, "d", d, 0, NAN) || !checkRange(function, d, x, phase, (x_key == CoolProp::iUmass) ? "u" : "h", x, NAN, NAN))
+		return;
+	if (_memo && memoLookup(function, d, x, phase, properties))
+		return;
+
+	try{
+		bool solved = false;
+		if (_isPure && phase == 2)
+			solved = solveTwoPhase_dx(d, x_key, x);
+
+		// Update the internal variables in the state instance
+		if (!solved)
+			flash(inputs, d, x);
+
+		if (!ValidNumber(state->p()) || !ValidNumber(state->T()))
+		{
+			throw CoolProp::ValueError(format("d-%s [%g, %g] failed for update",(x_key == CoolProp::iUmass) ? "u" : "h",d,x));
+		}
+
+		// Set the values in the output structure
+		this->postStateChange(properties);
+		if (_memo)
+			_memo->insert(_memoSolver, function, d, x, phase, properties);
+	}
+	catch(std::exception &e)
+	{
+		failedState(function, d, x, phase, e.what());
+	}
+}
+
+/// Mixture value of x_key at temperature T for the quality matching the density d
+static double twoPhaseResidual_dx(shared_ptr<CoolProp::AbstractState> &state, double T, double d, CoolProp::parameters x_key, double x, double &Q){
+	state->update(CoolProp::QT_INPUTS, 0, T);
+	double vl = 1.0/state->saturated_liquid_keyed_output(CoolProp::iDmass);
+	double vv = 1.0/state->saturated_vapor_keyed_output(CoolProp::iDmass);
+	Q = (1.0/d - vl)/(vv - vl);
+	double xl = state->saturated_liquid_keyed_output(x_key);
+	double xv = state->saturated_vapor_keyed_output(x_key);
+	return xl + Q*(xv - xl) - x;
+}
+
+/// Native two-phase solution for density-based inputs
+/*
+  Inside the dome of a pure fluid, the density and x (u or h) only depend on the
+  saturation temperature and the vapour quality. A secant iteration on the
+  saturation temperature, started in the middle of the saturation line, replaces
+  the generic two-dimensional flash. Returns false if the point is not inside the
+  dome or the iteration fails.
+*/
+bool CoolPropSolver::solveTwoPhase_dx(double d, CoolProp::parameters x_key, double x){
+	if (!(d > 0) || !ValidNumber(x))
+		return false;
+	try{
+		double Tmin = state->Ttriple();
+		double Tmax = close2Crit().Tsat;
+		double T1 = 0.5*(Tmin + Tmax);
+		double T2 = (T1*(1 + 1e-4) < Tmax) ? T1*(1 + 1e-4) : T1*(1 - 1e-4);
+		double Q;
+		double f1 = twoPhaseResidual_dx(state, T1, d, x_key, x, Q);
+		double f2 = twoPhaseResidual_dx(state, T2, d, x_key, x, Q);
+		double tol = 1e-10*((fabs(x) > 1) ? fabs(x) : 1);
+		int iter;
+		for (iter = 0; iter < 50 && fabs(f2) > tol; iter++){
+			double dT = -f2*(T2 - T1)/(f2 - f1);
+			if (!ValidNumber(dT))
+				return false;
+			T1 = T2;
+			f1 = f2;
+			T2 = T2 + dT;
+			if (T2 < Tmin) T2 = Tmin;
+			if (T2 > Tmax) T2 = Tmax;
+			if (T2 == T1)
+				break;
+			f2 = twoPhaseResidual_dx(state, T2, d, x_key, x, Q);
+		}
+		if (fabs(f2) > tol*1e3 || Q < 0 || Q > 1)
+			return false;
+
+		state->update(CoolProp::QT_INPUTS, Q, T2);
+		if (debug_level > 5)
+			std::cout << format("solveTwoPhase_dx converged in %d iterations: T=%0.16e, Q=%0.16e\n",iter,T2,Q);
+		return true;
+	}
+	catch(std::exception &e)
+	{
+		if (debug_level > 5)
+			std::cout << format("solveTwoPhase_dx failed: %s\n",e.what());
+		return false;
 	}
 }
 
@@ -841,11 +2351,31 @@ double CoolPropSolver::hv(ExternalSaturationProperties *const properties){
 	return NAN;
 }
 
+/// Surface tension of the bubble line state _satL
+/*
+  The surface tension model is probed by the first call, instead of catching
+  an exception in every call, fluids without a model get NaN.
+*/
+double CoolPropSolver::saturationSigma(){
+	if (!_surfaceTensionProbed) {
+		_surfaceTensionProbed = true;
+		try {
+			double sigma = _satL->surface_tension();
+			_hasSurfaceTension = true;
+			return sigma;
+		} catch (...) {
+			_hasSurfaceTension = false;
+		}
+		if (debug_level > 5) std::cout << format("Surface tension is not available for fluid %s \n",substanceName.c_str());
+	}
+	return _hasSurfaceTension ? _satL->surface_tension() : NAN;
+}
+
+/// Surface tension of the saturation record, NaN for incompressibles and fluids without a model
 double CoolPropSolver::sigma(ExternalSaturationProperties *const properties){
-    // Base function returns an error if called - should be redeclared by the solver object
-	errorMessage((char*)"Internal error: sigma() not implemented in the Solver object");
-	//throw NotImplementedError((char*)"Internal error: sigma() not implemented in the Solver object");
-	return NAN;
+	if (!isCompressible)
+		return NAN;
+	return properties->sigma;
 }
 
 double CoolPropSolver::sl(ExternalSaturationProperties *const properties){
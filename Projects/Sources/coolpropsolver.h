@@ -5,8 +5,12 @@
 #if (EXTERNALMEDIA_COOLPROP == 1)
 
 #include "basesolver.h"
+#include "statistics.h"
+
+class MemoStore;
 #include "AbstractState.h"
 #include "crossplatform_shared_ptr.h"
+#include <vector>
 
 /*! CoolProp solver class */
 /*!
@@ -39,8 +43,141 @@ protected:
 	double _p_eps   ; /* relative tolerance margin for subcritical pressure conditions */
 	double _delta_h ; /* delta_h for one-phase/two-phase discrimination */
 	ExternalSaturationProperties _satPropsClose2Crit; /* saturation properties close to  critical conditions */
-
+	std::vector<double> _fractions; /* composition passed in the substance name */
+	bool _isPure; /* pure fluid, saturation at a given p or T is a single point */
+	shared_ptr<CoolProp::AbstractState> _satL, _satV; /* saturation states with imposed liquid and gas phase */
+	bool _sharedVLE; /* dew line is derived from the bubble line VLE solve */
+	bool _hasSurfaceTension; /* the fluid has a surface tension model */
+	bool _surfaceTensionProbed; /* _hasSurfaceTension is known, probed by the first saturation call */
+	bool _close2CritReady; /* _satPropsClose2Crit is complete, before only psat is set */
+
+	/*! Saturated end-point properties used to extend the two-phase region */
+	struct TwoPhaseEndPoints {
+		double p; /* pressure the end points were computed at */
+		double cv[2], a[2], cp[2], eta[2], lambda[2]; /* [0] bubble line, [1] dew line */
+	};
+	static const int _nTwoPhaseCache = 8;
+	TwoPhaseEndPoints _twoPhaseCache[_nTwoPhaseCache]; /* small ring buffer of recently used pressures */
+	int _twoPhaseCacheNext;
+	bool twophase_endpoint_cache; /* reuse the cached end points, off to evaluate them for every state */
+	double twophase_cache_ptol; /* relative pressure tolerance for reusing cached end points */
+
+	/*! Spline of the smoothed two-phase density at one pressure, in molar units like in CoolProp */
+	struct TwoPhaseSpline {
+		double p, x_end; /* pressure and end quality of the spline */
+		double hL, dhL_dp; /* bubble enthalpy and its derivative along the saturation line */
+		double a, b, c, d; /* rho = a*D^3 + b*D^2 + c*D + d with D = h - hL */
+		double da_dp, db_dp, dc_dp, dd_dp; /* pressure derivatives of the coefficients at constant h */
+	};
+	std::string _eosBackend; /* backend without tabular prefix, used for the auxiliary state */
+	bool _tabular; /* the states use the CoolProp TTSE or bicubic tables */
+	MemoStore *_memo; /* persistent store of computed states, NULL if not used */
+
+	/*! Recent single-phase p-h state reused by the approximate cache */
+	struct TaylorEntry {
+		double p, h; /* inputs, p is NaN for empty entries */
+		int phase; /* phase input */
+		ExternalThermodynamicState state;
+	};
+	static const int _nTaylorCache = 4;
+	TaylorEntry _taylorCache[_nTaylorCache];
+	int _taylorCacheNext;
+	double taylor_cache_rtol; /* relative input tolerance of the approximate p-h cache, 0 to disable */
+	unsigned long long _memoSolver; /* solver hash in the memo store */
+
+	/*! Converged single-phase state in a warm-start index */
+	struct WarmStartEntry {
+		double u1, u2; /* scaled inputs, u1 is NaN for empty slots */
+		double T, d; /* solution, NaN if the cell only holds the slow flag */
+		bool slow; /* the generic flash was slow or failed in this cell, bounded flashes only */
+	};
+	/*! Grid hash of recently converged states for one pair of inputs */
+	struct WarmStartIndex {
+		std::vector<WarmStartEntry> slots; /* one state per grid cell, empty if not used */
+		bool log1; /* the first input is scaled logarithmically (pressure) */
+		double width1, width2; /* size of a grid cell */
+	};
+	/*! Inputs of a recently failed state function and its error */
+	struct FailedState {
+		int function; /* Statistics::Function of the state function, -1 for empty entries */
+		double x1, x2;
+		int phase;
+		std::string message;
+	};
+	std::vector<FailedState> _failureCache; /* ring buffer, empty if not used */
+	int _failureCacheNext;
+
+	/*! Validity envelope of the equation of state, with a margin, NaN where there is no bound */
+	static const int _nEnvelope = 8;
+	struct ValidityEnvelope {
+		double pmax, Tmin, Tmax;
+		double lnp0, dlnp; /* log-spaced pressures of the enthalpy bounds */
+		double hmin[_nEnvelope], hmax[_nEnvelope]; /* h(p, Tmin) and h(p, Tmax), NaN if unknown */
+	};
+	ValidityEnvelope _envelope;
+	/*! Stages of the fallback chain, tried in turn when a flash fails */
+	enum FallbackStage { fallbackGuesses, fallbackPhase, fallbackEos };
+	std::vector<FallbackStage> _fallbackChain; /* empty if failures are reported at once */
+	shared_ptr<CoolProp::AbstractState> _fallbackState; /* equation of state of tabular solvers for the eos stage */
+	bool _fallbackSwapped; /* state and _fallbackState are swapped after a successful eos stage */
+	double _lastT, _lastD; /* last converged single-phase state, guess of the fallback stages */
+	CoolProp::phases _lastPhase;
+	bool check_range; /* reject inputs outside the envelope before calling CoolProp, off by default */
+	bool _enthalpyBoundsReady; /* the enthalpy bounds of _envelope have been computed */
+	int warmstart_index; /* number of slots of each warm-start index, 0 to disable */
+	WarmStartIndex _warmStartPS, _warmStartHS;
+	static const int _nBoundedIndex = 1024;
+	WarmStartIndex _boundedPH, _boundedPS; /* converged states of the bounded flashes, empty if not used */
+	/*! Result of the Newton iteration on temperature and density */
+	enum SolveResult { solveConverged, solveFailed, solveOverBudget };
+	int flash_max_iter; /* budget of CoolProp updates of the p-h and p-s flashes near the critical pressure, 0 to disable */
+	double flash_max_time; /* time budget in seconds of the same flashes, 0 for no limit */
+	bool flash_fallback_approximate; /* extrapolate from the nearest converged state instead of an error when the budget is exceeded */
+	shared_ptr<CoolProp::AbstractState> _auxState; /* auxiliary state for the spline end points */
+	bool _splineNative; /* false once the closed form spline failed, CoolProp is used instead */
+	int twophase_spline_table; /* number of tabulated pressures for the spline data, 0 to disable */
+	TwoPhaseSpline _splineCache[_nTwoPhaseCache];
+	int _splineCacheNext;
+	map<double, std::vector<TwoPhaseSpline> > _splineTables; /* pressure tables, one per end quality */
+
+	static void parseSubstance(const std::string &libraryName, const std::string &substanceName, std::string &backend, std::string &fluid, std::vector<double> &fractions);
+	static bool setComposition(CoolProp::AbstractState *newstate, const std::vector<double> &fractions);
+	CoolProp::AbstractState *newState(const std::string &backend);
+	const ExternalSaturationProperties &close2Crit();
+	double saturationSigma();
+	bool aboveClose2Crit_T(double T);
 	virtual void postStateChange(ExternalThermodynamicState *const properties);
+	bool setSaturatedState(ExternalSaturationProperties *const properties, int Q, int phase, ExternalThermodynamicState *const satProperties);
+	const TwoPhaseEndPoints &twoPhaseEndPoints(double p);
+	void computeTwoPhaseSpline(double p, double x_end, TwoPhaseSpline &spline);
+	void buildSplineTable(double x_end, std::vector<TwoPhaseSpline> &table);
+	TwoPhaseSpline twoPhaseSpline(double p, double x_end);
+	bool taylorCacheLookup(double p, double h, int phase, ExternalThermodynamicState *const properties);
+	void extrapolateState(const ExternalThermodynamicState &s0, double p, double h, ExternalThermodynamicState *const properties);
+	void taylorCacheInsert(double p, double h, int phase, const ExternalThermodynamicState *properties);
+	void flash(CoolProp::input_pairs inputs, double value1, double value2);
+	bool fallbackFlash(FallbackStage stage, CoolProp::input_pairs inputs, double value1, double value2);
+	void restoreState();
+	bool memoLookup(Statistics::Function function, double x1, double x2, int phase, ExternalThermodynamicState *const properties);
+	bool failureCacheLookup(Statistics::Function function, double x1, double x2, int phase);
+	void failedState(Statistics::Function function, double x1, double x2, int phase, const char *message);
+	void computeEnvelope();
+	void computeEnthalpyBounds();
+	bool checkRange(Statistics::Function function, double x1, double x2, int phase, const char *name, double value, double min, double max);
+	bool checkEnthalpy(Statistics::Function function, double p, double h, int phase);
+	void initWarmStartIndex(WarmStartIndex &index, int nSlots, bool log1, double width1, double width2);
+	bool warmStartLookup(const WarmStartIndex &index, double x1, double x2, double &T, double &d, int radius = 1) const;
+	void warmStartInsert(WarmStartIndex &index, double x1, double x2);
+	void warmStartMarkSlow(WarmStartIndex &index, double x1, double x2);
+	bool warmStartSlow(const WarmStartIndex &index, double x1, double x2) const;
+	SolveResult solveSinglePhase_Td(CoolProp::parameters key1, double x1, double tol1, CoolProp::parameters key2, double x2, double tol2, double T, double d, int maxIter, double maxTime, int *evaluations = NULL);
+	SolveResult solveIsobar_T(CoolProp::parameters key2, double p, double x2, double tol2, int maxIter, double maxTime, int *evaluations = NULL);
+	void updateWarmStart(CoolProp::input_pairs inputs, WarmStartIndex &index, CoolProp::parameters key1, double x1, CoolProp::parameters key2, double x2);
+	bool boundedPressure(double p) const;
+	bool boundedFlash(CoolProp::parameters key2, WarmStartIndex &index, double p, double x2, ExternalThermodynamicState *const properties);
+	void smoothedTwoPhaseDensity(double x_end, bool with_density, ExternalThermodynamicState *const properties);
+	bool solveTwoPhase_dx(double d, CoolProp::parameters x_key, double x);
+	void setState_dx(CoolProp::input_pairs inputs, CoolProp::parameters x_key, double &d, double &x, int &phase, ExternalThermodynamicState *const properties);
 	long makeDerivString(const string &of, const string &wrt, const string &cst);
 	double interp_linear(double Q, double valueL, double valueV);
 	double interp_recip(double Q, double valueL, double valueV);
@@ -49,6 +186,9 @@ public:
 	CoolPropSolver(const std::string &mediumName, const std::string &libraryName, const std::string &substanceName);
 	~CoolPropSolver();
 	virtual void setFluidConstants();
+	virtual void warmUp();
+	virtual MemoryFootprint memoryFootprint() const;
+	static bool fluidConstants(const std::string &libraryName, const std::string &substanceName, FluidConstants &constants);
 
 	virtual void setSat_p(double &p, ExternalSaturationProperties *const properties);
 	virtual void setSat_T(double &T, ExternalSaturationProperties *const properties);
@@ -61,6 +201,8 @@ public:
 	virtual void setState_dT(double &d, double &T, int &phase, ExternalThermodynamicState *const properties);
 	virtual void setState_ps(double &p, double &s, int &phase, ExternalThermodynamicState *const properties);
 	virtual void setState_hs(double &h, double &s, int &phase, ExternalThermodynamicState *const properties);
+	virtual void setState_du(double &d, double &u, int &phase, ExternalThermodynamicState *const properties);
+	virtual void setState_dh(double &d, double &h, int &phase, ExternalThermodynamicState *const properties);
 
 	virtual double partialDeriv_state(const string &of, const string &wrt, const string &cst, ExternalThermodynamicState *const properties);
 
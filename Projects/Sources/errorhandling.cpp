@@ -24,7 +24,20 @@ void (*ModelicaErrorPtr)(const char *) = nullptr;
 void (*ModelicaWarningPtr)(const char *) = nullptr;
 #endif
 
+/* Innermost ErrorCapture of the calling thread */
+static thread_local ErrorCapture *_capture = nullptr;
+
+ErrorCapture::ErrorCapture() : _previous(_capture){
+	_capture = this;
+}
+
+ErrorCapture::~ErrorCapture(){
+	_capture = _previous;
+}
+
 void errorMessage(char *errorMsg){
+    if (_capture)
+        throw ExternalMediaError(errorMsg);
     //Add prefix to help users understand this message comes from externalmedia
     std::string msg="ExternalMedia error: ";
     msg+=errorMsg;
@@ -52,6 +65,10 @@ void errorMessage(char *errorMsg){
 }
 
 void warningMessage(char *warningMsg){
+    if (_capture) {
+        _capture->warnings.push_back(warningMsg);
+        return;
+    }
     //Add prefix to help users understand this message comes from externalmedia
     std::string msg="ExternalMedia warning: ";
     msg+=warningMsg;
@@ -13,6 +13,10 @@
 #ifndef ERRORHANDLING_H_
 #define ERRORHANDLING_H_
 
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #ifdef WIN32
 extern void (*ModelicaErrorPtr)(const char *);
 extern void (*ModelicaWarningPtr)(const char *);
@@ -32,4 +36,30 @@ void errorMessage(char *errorMsg);
 */
 void warningMessage(char *warningMsg);
 
+/*! Error raised by errorMessage while the messages are captured */
+class ExternalMediaError : public std::runtime_error{
+public:
+	explicit ExternalMediaError(const std::string &errorMsg) : std::runtime_error(errorMsg){}
+};
+
+/*! Scope in which the messages of the calling thread are captured */
+/*!
+  The Modelica utility functions may only be called from the simulation
+  thread. While an ErrorCapture exists in a thread, errorMessage throws an
+  ExternalMediaError and warningMessage appends the message to warnings,
+  so that worker threads can hand them over to the simulation thread.
+*/
+class ErrorCapture{
+public:
+	ErrorCapture();
+	~ErrorCapture();
+
+	/*! Captured warning messages */
+	std::vector<std::string> warnings;
+
+protected:
+	/*! Enclosing capture of the same thread */
+	ErrorCapture *_previous;
+};
+
 #endif /* ERRORHANDLING_H_ */
@@ -7,7 +7,10 @@
 #include "basesolver.h"
 #include "solvermap.h"
 #include "errorhandling.h"
+#include "statistics.h"
+#include "trace.h"
 #include <math.h>
+#include <string.h>
 
 //! Get molar mass
 /*!
@@ -18,7 +21,7 @@
 */
 double TwoPhaseMedium_getMolarMass_C_impl(const char *mediumName, const char *libraryName, const char *substanceName){
 	// Return molar mass
-	return SolverMap::getSolver(mediumName, libraryName, substanceName)->molarMass();
+	return SolverMap::getFluidConstants(mediumName, libraryName, substanceName).MM;
 }
 
 //! Get critical temperature
@@ -30,7 +33,7 @@ double TwoPhaseMedium_getMolarMass_C_impl(const char *mediumName, const char *li
 */
 double TwoPhaseMedium_getCriticalTemperature_C_impl(const char *mediumName, const char *libraryName, const char *substanceName){
 	// Return critical temperature
-	return SolverMap::getSolver(mediumName, libraryName, substanceName)->criticalTemperature();
+	return SolverMap::getFluidConstants(mediumName, libraryName, substanceName).Tc;
 }
 
 //! Get critical pressure
@@ -42,7 +45,7 @@ double TwoPhaseMedium_getCriticalTemperature_C_impl(const char *mediumName, cons
 */
 double TwoPhaseMedium_getCriticalPressure_C_impl(const char *mediumName, const char *libraryName, const char *substanceName){
 	// Return critical pressure
-	return SolverMap::getSolver(mediumName, libraryName, substanceName)->criticalPressure();
+	return SolverMap::getFluidConstants(mediumName, libraryName, substanceName).pc;
 }
 
 //! Get critical molar volume
@@ -54,7 +57,8 @@ double TwoPhaseMedium_getCriticalPressure_C_impl(const char *mediumName, const c
 */
 double TwoPhaseMedium_getCriticalMolarVolume_C_impl(const char *mediumName, const char *libraryName, const char *substanceName){
 	// Return critical molar volume
-	return SolverMap::getSolver(mediumName, libraryName, substanceName)->criticalMolarVolume();
+	const FluidConstants &constants = SolverMap::getFluidConstants(mediumName, libraryName, substanceName);
+	return constants.MM/constants.dc;
 }
 
 //! Compute properties from p, h, and phase
@@ -71,7 +75,13 @@ double TwoPhaseMedium_getCriticalMolarVolume_C_impl(const char *mediumName, cons
 void TwoPhaseMedium_setState_ph_C_impl(double p, double h, int phase, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_ph);
+	StatisticsTimer timer(solver, Statistics::setState_ph);
+	trace.input(p);
+	trace.input(h);
+	trace.input(phase);
     solver->setState_ph(p, h, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute properties from p and T
@@ -89,7 +99,12 @@ void TwoPhaseMedium_setState_ph_C_impl(double p, double h, int phase, void *stat
 void TwoPhaseMedium_setState_pT_C_impl(double p, double T, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_pT);
+	StatisticsTimer timer(solver, Statistics::setState_pT);
+	trace.input(p);
+	trace.input(T);
     solver->setState_pT(p, T, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute properties from d, T, and phase
@@ -106,7 +121,13 @@ void TwoPhaseMedium_setState_pT_C_impl(double p, double T, void *state,
 void TwoPhaseMedium_setState_dT_C_impl(double d, double T, int phase, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_dT);
+	StatisticsTimer timer(solver, Statistics::setState_dT);
+	trace.input(d);
+	trace.input(T);
+	trace.input(phase);
     solver->setState_dT(d, T, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute properties from p, s, and phase
@@ -123,7 +144,13 @@ void TwoPhaseMedium_setState_dT_C_impl(double d, double T, int phase, void *stat
 void TwoPhaseMedium_setState_ps_C_impl(double p, double s, int phase, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_ps);
+	StatisticsTimer timer(solver, Statistics::setState_ps);
+	trace.input(p);
+	trace.input(s);
+	trace.input(phase);
     solver->setState_ps(p, s, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute properties from h, s, and phase
@@ -140,7 +167,59 @@ void TwoPhaseMedium_setState_ps_C_impl(double p, double s, int phase, void *stat
 void TwoPhaseMedium_setState_hs_C_impl(double h, double s, int phase, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_hs);
+	StatisticsTimer timer(solver, Statistics::setState_hs);
+	trace.input(h);
+	trace.input(s);
+	trace.input(phase);
     solver->setState_hs(h, s, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
+}
+
+//! Compute properties from d, u, and phase
+/*!
+  This function computes the properties for the specified inputs.
+  @param d Density
+  @param u Specific internal energy
+  @param phase Phase (2 for two-phase, 1 for one-phase, 0 if not known)
+  @param state Pointer to return values for ExternalThermodynamicState struct
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+*/
+void TwoPhaseMedium_setState_du_C_impl(double d, double u, int phase, void *state,
+								 const char *mediumName, const char *libraryName, const char *substanceName){
+	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_du);
+	StatisticsTimer timer(solver, Statistics::setState_du);
+	trace.input(d);
+	trace.input(u);
+	trace.input(phase);
+    solver->setState_du(d, u, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
+}
+
+//! Compute properties from d, h, and phase
+/*!
+  This function computes the properties for the specified inputs.
+  @param d Density
+  @param h Specific enthalpy
+  @param phase Phase (2 for two-phase, 1 for one-phase, 0 if not known)
+  @param state Pointer to return values for ExternalThermodynamicState struct
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+*/
+void TwoPhaseMedium_setState_dh_C_impl(double d, double h, int phase, void *state,
+								 const char *mediumName, const char *libraryName, const char *substanceName){
+	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setState_dh);
+	StatisticsTimer timer(solver, Statistics::setState_dh);
+	trace.input(d);
+	trace.input(h);
+	trace.input(phase);
+    solver->setState_dh(d, h, phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute partial derivative from a populated state record
@@ -157,7 +236,13 @@ void TwoPhaseMedium_setState_hs_C_impl(double h, double s, int phase, void *stat
 double TwoPhaseMedium_partialDeriv_state_C_impl(const char *of, const char *wrt, const char *cst,
 		void *state, const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->partialDeriv_state(of, wrt, cst, static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::partialDeriv_state);
+	StatisticsTimer timer(solver, Statistics::partialDeriv_state);
+	trace.input(of);
+	trace.input(wrt);
+	trace.input(cst);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->partialDeriv_state(of, wrt, cst, static_cast<ExternalThermodynamicState*>(state)));
 }
 
 
@@ -168,7 +253,10 @@ double TwoPhaseMedium_partialDeriv_state_C_impl(const char *of, const char *wrt,
 double TwoPhaseMedium_prandtlNumber_C_impl(void *state,
 									 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->Pr(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::prandtlNumber);
+	StatisticsTimer timer(solver, Statistics::prandtlNumber);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->Pr(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return temperature of specified medium
@@ -178,7 +266,10 @@ double TwoPhaseMedium_prandtlNumber_C_impl(void *state,
 double TwoPhaseMedium_temperature_C_impl(void *state,
 								   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->T(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::temperature);
+	StatisticsTimer timer(solver, Statistics::temperature);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->T(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return velocity of sound of specified medium
@@ -188,7 +279,10 @@ double TwoPhaseMedium_temperature_C_impl(void *state,
 double TwoPhaseMedium_velocityOfSound_C_impl(void *state,
 									   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->a(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::velocityOfSound);
+	StatisticsTimer timer(solver, Statistics::velocityOfSound);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->a(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return isobaric expansion coefficient of specified medium
@@ -198,7 +292,10 @@ double TwoPhaseMedium_velocityOfSound_C_impl(void *state,
 double TwoPhaseMedium_isobaricExpansionCoefficient_C_impl(void *state,
 													const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->beta(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::isobaricExpansionCoefficient);
+	StatisticsTimer timer(solver, Statistics::isobaricExpansionCoefficient);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->beta(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return specific heat capacity cp of specified medium
@@ -208,7 +305,10 @@ double TwoPhaseMedium_isobaricExpansionCoefficient_C_impl(void *state,
 double TwoPhaseMedium_specificHeatCapacityCp_C_impl(void *state,
 											  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->cp(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::specificHeatCapacityCp);
+	StatisticsTimer timer(solver, Statistics::specificHeatCapacityCp);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->cp(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return specific heat capacity cv of specified medium
@@ -218,7 +318,10 @@ double TwoPhaseMedium_specificHeatCapacityCp_C_impl(void *state,
 double TwoPhaseMedium_specificHeatCapacityCv_C_impl(void *state,
 											  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->cv(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::specificHeatCapacityCv);
+	StatisticsTimer timer(solver, Statistics::specificHeatCapacityCv);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->cv(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return density of specified medium
@@ -228,7 +331,10 @@ double TwoPhaseMedium_specificHeatCapacityCv_C_impl(void *state,
 double TwoPhaseMedium_density_C_impl(void *state,
 							   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->d(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::density);
+	StatisticsTimer timer(solver, Statistics::density);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->d(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return derivative of density wrt specific enthalpy at constant pressure of specified medium
@@ -238,7 +344,10 @@ double TwoPhaseMedium_density_C_impl(void *state,
 double TwoPhaseMedium_density_derh_p_C_impl(void *state,
 									  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->ddhp(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::density_derh_p);
+	StatisticsTimer timer(solver, Statistics::density_derh_p);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->ddhp(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return derivative of density wrt pressure at constant specific enthalpy of specified medium
@@ -248,7 +357,10 @@ double TwoPhaseMedium_density_derh_p_C_impl(void *state,
 double TwoPhaseMedium_density_derp_h_C_impl(void *state,
 									  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->ddph(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::density_derp_h);
+	StatisticsTimer timer(solver, Statistics::density_derp_h);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->ddph(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return dynamic viscosity of specified medium
@@ -258,7 +370,10 @@ double TwoPhaseMedium_density_derp_h_C_impl(void *state,
 double TwoPhaseMedium_dynamicViscosity_C_impl(void *state,
 										const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->eta(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::dynamicViscosity);
+	StatisticsTimer timer(solver, Statistics::dynamicViscosity);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->eta(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return specific enthalpy of specified medium
@@ -268,7 +383,10 @@ double TwoPhaseMedium_dynamicViscosity_C_impl(void *state,
 double TwoPhaseMedium_specificEnthalpy_C_impl(void *state,
 										const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->h(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::specificEnthalpy);
+	StatisticsTimer timer(solver, Statistics::specificEnthalpy);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->h(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return isothermal compressibility of specified medium
@@ -278,7 +396,10 @@ double TwoPhaseMedium_specificEnthalpy_C_impl(void *state,
 double TwoPhaseMedium_isothermalCompressibility_C_impl(void *state,
 												 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->kappa(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::isothermalCompressibility);
+	StatisticsTimer timer(solver, Statistics::isothermalCompressibility);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->kappa(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return thermal conductivity of specified medium
@@ -288,7 +409,10 @@ double TwoPhaseMedium_isothermalCompressibility_C_impl(void *state,
 double TwoPhaseMedium_thermalConductivity_C_impl(void *state,
 										   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->lambda(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::thermalConductivity);
+	StatisticsTimer timer(solver, Statistics::thermalConductivity);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->lambda(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return pressure of specified medium
@@ -298,7 +422,10 @@ double TwoPhaseMedium_thermalConductivity_C_impl(void *state,
 double TwoPhaseMedium_pressure_C_impl(void *state,
 								const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->p(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::pressure);
+	StatisticsTimer timer(solver, Statistics::pressure);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->p(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return specific entropy of specified medium
@@ -308,7 +435,10 @@ double TwoPhaseMedium_pressure_C_impl(void *state,
 double TwoPhaseMedium_specificEntropy_C_impl(void *state,
 									   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->s(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::specificEntropy);
+	StatisticsTimer timer(solver, Statistics::specificEntropy);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->s(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return derivative of density wrt pressure and specific enthalpy of specified medium
@@ -318,14 +448,21 @@ double TwoPhaseMedium_specificEntropy_C_impl(void *state,
 double TwoPhaseMedium_density_ph_der_C_impl(void *state,
 									  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->d_der(static_cast<ExternalThermodynamicState*>(state));
+	CallTrace trace(solver, Statistics::density_ph_der);
+	StatisticsTimer timer(solver, Statistics::density_ph_der);
+	trace.input(static_cast<ExternalThermodynamicState*>(state));
+    return trace.result(solver->d_der(static_cast<ExternalThermodynamicState*>(state)));
 }
 
 //! Return the enthalpy at pressure p after an isentropic transformation from the specified medium state
-double TwoPhaseMedium_isentropicEnthalpy_C_impl(double p_downstream, ExternalThermodynamicState *refState,
+double TwoPhaseMedium_isentropicEnthalpy_C_impl(double p_downstream, void *refState,
 										  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->isentropicEnthalpy(p_downstream, refState);
+	CallTrace trace(solver, Statistics::isentropicEnthalpy);
+	StatisticsTimer timer(solver, Statistics::isentropicEnthalpy);
+	trace.input(p_downstream);
+	trace.input(static_cast<ExternalThermodynamicState*>(refState));
+    return trace.result(solver->isentropicEnthalpy(p_downstream, static_cast<ExternalThermodynamicState*>(refState)));
 }
 
 //! Compute saturation properties from p
@@ -340,7 +477,11 @@ double TwoPhaseMedium_isentropicEnthalpy_C_impl(double p_downstream, ExternalThe
 void TwoPhaseMedium_setSat_p_C_impl(double p, void *sat,
 							  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setSat_p);
+	StatisticsTimer timer(solver, Statistics::setSat_p);
+	trace.input(p);
     solver->setSat_p(p, static_cast<ExternalSaturationProperties*>(sat));
+	trace.output(static_cast<ExternalSaturationProperties*>(sat));
 }
 
 //! Compute saturation properties from T
@@ -355,7 +496,11 @@ void TwoPhaseMedium_setSat_p_C_impl(double p, void *sat,
 void TwoPhaseMedium_setSat_T_C_impl(double T, void *sat,
 							  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setSat_T);
+	StatisticsTimer timer(solver, Statistics::setSat_T);
+	trace.input(T);
     solver->setSat_T(T, static_cast<ExternalSaturationProperties*>(sat));
+	trace.output(static_cast<ExternalSaturationProperties*>(sat));
 }
 
 //! Compute bubble state
@@ -371,7 +516,12 @@ void TwoPhaseMedium_setSat_T_C_impl(double T, void *sat,
 void TwoPhaseMedium_setBubbleState_C_impl(void *sat, int phase, void *state,
 									const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setBubbleState);
+	StatisticsTimer timer(solver, Statistics::setBubbleState);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+	trace.input(phase);
     solver->setBubbleState(static_cast<ExternalSaturationProperties*>(sat), phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute dew state
@@ -387,23 +537,34 @@ void TwoPhaseMedium_setBubbleState_C_impl(void *sat, int phase, void *state,
 void TwoPhaseMedium_setDewState_C_impl(void *sat, int phase, void *state,
 								 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::setDewState);
+	StatisticsTimer timer(solver, Statistics::setDewState);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+	trace.input(phase);
     solver->setDewState(static_cast<ExternalSaturationProperties*>(sat), phase, static_cast<ExternalThermodynamicState*>(state));
+	trace.output(static_cast<ExternalThermodynamicState*>(state));
 }
 
 //! Compute saturation temperature for specified medium and pressure
 double TwoPhaseMedium_saturationTemperature_C_impl(double p, const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::saturationTemperature);
+	StatisticsTimer timer(solver, Statistics::saturationTemperature);
+	trace.input(p);
     ExternalSaturationProperties sat;
 	solver->setSat_p(p, &sat);
-	return sat.Tsat;
+	return trace.result(sat.Tsat);
 }
 
 //! Compute derivative of saturation temperature for specified medium and pressure
 double TwoPhaseMedium_saturationTemperature_derp_C_impl(double p, const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::saturationTemperature_derp);
+	StatisticsTimer timer(solver, Statistics::saturationTemperature_derp);
+	trace.input(p);
     ExternalSaturationProperties sat;
 	solver->setSat_p(p, &sat);
-	return sat.dTp;
+	return trace.result(sat.dTp);
 }
 
 //! Return derivative of saturation temperature of specified medium from saturation properties
@@ -413,7 +574,10 @@ double TwoPhaseMedium_saturationTemperature_derp_C_impl(double p, const char *me
 double TwoPhaseMedium_saturationTemperature_derp_sat_C_impl(void *sat,
 													  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->dTp(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::saturationTemperature_derp_sat);
+	StatisticsTimer timer(solver, Statistics::saturationTemperature_derp_sat);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->dTp(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return derivative of bubble density wrt pressure of specified medium from saturation properties
@@ -423,7 +587,10 @@ double TwoPhaseMedium_saturationTemperature_derp_sat_C_impl(void *sat,
 double TwoPhaseMedium_dBubbleDensity_dPressure_C_impl(void *sat,
 												const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->ddldp(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dBubbleDensity_dPressure);
+	StatisticsTimer timer(solver, Statistics::dBubbleDensity_dPressure);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->ddldp(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return derivative of dew density wrt pressure of specified medium from saturation properties
@@ -433,7 +600,10 @@ double TwoPhaseMedium_dBubbleDensity_dPressure_C_impl(void *sat,
 double TwoPhaseMedium_dDewDensity_dPressure_C_impl(void *sat,
 											 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->ddvdp(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dDewDensity_dPressure);
+	StatisticsTimer timer(solver, Statistics::dDewDensity_dPressure);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->ddvdp(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return derivative of bubble specific enthalpy wrt pressure of specified medium from saturation properties
@@ -443,7 +613,10 @@ double TwoPhaseMedium_dDewDensity_dPressure_C_impl(void *sat,
 double TwoPhaseMedium_dBubbleEnthalpy_dPressure_C_impl(void *sat,
 												 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->dhldp(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dBubbleEnthalpy_dPressure);
+	StatisticsTimer timer(solver, Statistics::dBubbleEnthalpy_dPressure);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->dhldp(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return derivative of dew specific enthalpy wrt pressure of specified medium from saturation properties
@@ -453,7 +626,10 @@ double TwoPhaseMedium_dBubbleEnthalpy_dPressure_C_impl(void *sat,
 double TwoPhaseMedium_dDewEnthalpy_dPressure_C_impl(void *sat,
 											  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->dhvdp(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dDewEnthalpy_dPressure);
+	StatisticsTimer timer(solver, Statistics::dDewEnthalpy_dPressure);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->dhvdp(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return bubble density of specified medium from saturation properties
@@ -463,7 +639,10 @@ double TwoPhaseMedium_dDewEnthalpy_dPressure_C_impl(void *sat,
 double TwoPhaseMedium_bubbleDensity_C_impl(void *sat,
 									 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->dl(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::bubbleDensity);
+	StatisticsTimer timer(solver, Statistics::bubbleDensity);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->dl(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return dew density of specified medium from saturation properties
@@ -473,7 +652,10 @@ double TwoPhaseMedium_bubbleDensity_C_impl(void *sat,
 double TwoPhaseMedium_dewDensity_C_impl(void *sat,
 								  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->dv(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dewDensity);
+	StatisticsTimer timer(solver, Statistics::dewDensity);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->dv(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return bubble specific enthalpy of specified medium from saturation properties
@@ -483,7 +665,10 @@ double TwoPhaseMedium_dewDensity_C_impl(void *sat,
 double TwoPhaseMedium_bubbleEnthalpy_C_impl(void *sat,
 									  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->hl(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::bubbleEnthalpy);
+	StatisticsTimer timer(solver, Statistics::bubbleEnthalpy);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->hl(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return dew specific enthalpy of specified medium from saturation properties
@@ -493,7 +678,10 @@ double TwoPhaseMedium_bubbleEnthalpy_C_impl(void *sat,
 double TwoPhaseMedium_dewEnthalpy_C_impl(void *sat,
 								   const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->hv(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dewEnthalpy);
+	StatisticsTimer timer(solver, Statistics::dewEnthalpy);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->hv(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Compute saturation pressure for specified medium and temperature
@@ -502,9 +690,12 @@ double TwoPhaseMedium_dewEnthalpy_C_impl(void *sat,
 */
 double TwoPhaseMedium_saturationPressure_C_impl(double T, const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
+	CallTrace trace(solver, Statistics::saturationPressure);
+	StatisticsTimer timer(solver, Statistics::saturationPressure);
+	trace.input(T);
     ExternalSaturationProperties sat;
 	solver->setSat_T(T, &sat);
-	return sat.psat;
+	return trace.result(sat.psat);
 }
 
 //! Return surface tension of specified medium
@@ -514,7 +705,10 @@ double TwoPhaseMedium_saturationPressure_C_impl(double T, const char *mediumName
 double TwoPhaseMedium_surfaceTension_C_impl(void *sat,
 									  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->sigma(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::surfaceTension);
+	StatisticsTimer timer(solver, Statistics::surfaceTension);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->sigma(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return bubble specific entropy of specified medium from saturation properties
@@ -524,7 +718,10 @@ double TwoPhaseMedium_surfaceTension_C_impl(void *sat,
 double TwoPhaseMedium_bubbleEntropy_C_impl(void *sat,
 									 const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->sl(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::bubbleEntropy);
+	StatisticsTimer timer(solver, Statistics::bubbleEntropy);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->sl(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 //! Return dew specific entropy of specified medium from saturation properties
@@ -534,7 +731,10 @@ double TwoPhaseMedium_bubbleEntropy_C_impl(void *sat,
 double TwoPhaseMedium_dewEntropy_C_impl(void *sat,
 								  const char *mediumName, const char *libraryName, const char *substanceName){
 	BaseSolver *solver = SolverMap::getSolver(mediumName, libraryName, substanceName);
-    return solver->sv(static_cast<ExternalSaturationProperties*>(sat));
+	CallTrace trace(solver, Statistics::dewEntropy);
+	StatisticsTimer timer(solver, Statistics::dewEntropy);
+	trace.input(static_cast<ExternalSaturationProperties*>(sat));
+    return trace.result(solver->sv(static_cast<ExternalSaturationProperties*>(sat)));
 }
 
 // The following functions implement a workaround to handle ModelicaError and ModelicaWarning on Windows
@@ -598,3 +798,121 @@ void TwoPhaseMedium_setState_hs_C_impl_err(double h, double s, int phase, void *
     // Call the actual C implementation function
     TwoPhaseMedium_setState_hs_C_impl(h, s, phase, static_cast<ExternalThermodynamicState*>(state), mediumName, libraryName, substanceName);
 }
+
+void TwoPhaseMedium_setState_du_C_impl_err(double d, double u, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *))
+{
+    // Assign the global pointers to the function parameters, so they are initialized for all other functions
+    #ifdef WIN32
+    ::ModelicaErrorPtr = ModelicaErrorPtr;
+    ::ModelicaWarningPtr = ModelicaWarningPtr;
+    #endif
+    // Call the actual C implementation function
+    TwoPhaseMedium_setState_du_C_impl(d, u, phase, static_cast<ExternalThermodynamicState*>(state), mediumName, libraryName, substanceName);
+}
+
+void TwoPhaseMedium_setState_dh_C_impl_err(double d, double h, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *))
+{
+    // Assign the global pointers to the function parameters, so they are initialized for all other functions
+    #ifdef WIN32
+    ::ModelicaErrorPtr = ModelicaErrorPtr;
+    ::ModelicaWarningPtr = ModelicaWarningPtr;
+    #endif
+    // Call the actual C implementation function
+    TwoPhaseMedium_setState_dh_C_impl(d, h, phase, static_cast<ExternalThermodynamicState*>(state), mediumName, libraryName, substanceName);
+}
+
+//! Enable or disable collecting call statistics
+/*!
+  @param enable 1 to collect statistics, 0 to stop collecting
+*/
+void TwoPhaseMedium_enableStatistics(int enable){
+	Statistics::enable(enable != 0);
+}
+
+//! Reset the call statistics
+void TwoPhaseMedium_resetStatistics(void){
+	Statistics::reset();
+}
+
+//! Return the call statistics of all solvers as JSON
+/*!
+  The statistics are copied to the buffer, truncated and always null terminated
+  if they do not fit. Call with size = 0 to query the required size.
+  @param buffer Output buffer, can be NULL if size is 0
+  @param size Size of the output buffer
+  @return Length of the JSON string, without the terminating null character
+*/
+int TwoPhaseMedium_getStatistics(char *buffer, int size){
+	string json = Statistics::toJSON();
+	if (buffer && size > 0){
+		size_t n = json.size() < (size_t)size ? json.size() : (size_t)size - 1;
+		memcpy(buffer, json.c_str(), n);
+		buffer[n] = '\0';
+	}
+	return (int)json.size();
+}
+
+//! Create solvers in advance
+/*!
+  The solvers are created with their tables and caches, instead of by their
+  first property call, serially unless EXTERNALMEDIA_PRELOAD_THREADS asks
+  for worker threads. The media can also be listed in a file named by the
+  environment variable EXTERNALMEDIA_PRELOAD.
+  @param spec Media separated by semicolons or new lines, each one given as
+              libraryName,substanceName
+  @return Number of media that could not be created
+*/
+int TwoPhaseMedium_preload(const char *spec){
+	return SolverMap::preload(spec);
+}
+
+//! Delete a solver
+/*!
+  The solver is created again by the next call for the medium. It must not
+  be used by calls running in other threads.
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+  @return Approximate number of bytes released, 0 if the solver does not exist
+*/
+double TwoPhaseMedium_releaseSolver(const char *mediumName, const char *libraryName, const char *substanceName){
+	return (double)SolverMap::releaseSolver(libraryName, substanceName);
+}
+
+//! Delete all solvers
+/*!
+  To be called when no simulation uses the library anymore, for example by
+  hosts that load and unload many models in the same process.
+  @return Approximate number of bytes released
+*/
+double TwoPhaseMedium_releaseAll(void){
+	return (double)SolverMap::releaseAll();
+}
+
+//! Get the memory held by a solver
+/*!
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+  @return Approximate number of bytes held by the solver, 0 if the solver does not exist
+*/
+double TwoPhaseMedium_memoryUsage(const char *mediumName, const char *libraryName, const char *substanceName){
+	return (double)SolverMap::memoryUsage(libraryName, substanceName);
+}
+
+//! Return the memory footprint of all solvers as JSON
+/*!
+  The report is copied to the buffer like by TwoPhaseMedium_getStatistics.
+  @param buffer Output buffer, can be NULL if size is 0
+  @param size Size of the output buffer
+  @return Length of the JSON string, without the terminating null character
+*/
+int TwoPhaseMedium_getMemoryReport(char *buffer, int size){
+	string json = SolverMap::memoryReport();
+	if (buffer && size > 0){
+		size_t n = json.size() < (size_t)size ? json.size() : (size_t)size - 1;
+		memcpy(buffer, json.c_str(), n);
+		buffer[n] = '\0';
+	}
+	return (int)json.size();
+}
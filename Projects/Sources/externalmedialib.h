@@ -181,6 +181,8 @@ extern "C" {
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_dT_C_impl(double d, double T, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_ps_C_impl(double p, double s, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_hs_C_impl(double h, double s, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_du_C_impl(double d, double u, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_dh_C_impl(double d, double h, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
 
 	/* These functions implement a workaround to handle ModelicaError and ModelicaWarning on Windows until a proper solution based on exporting symbols becomes available in Modelica tools */
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_ph_C_impl_err(double p, double h, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
@@ -188,6 +190,8 @@ extern "C" {
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_dT_C_impl_err(double d, double T, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_ps_C_impl_err(double p, double s, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
 	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_hs_C_impl_err(double h, double s, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_du_C_impl_err(double d, double u, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_setState_dh_C_impl_err(double d, double h, int phase, void *state, const char *mediumName, const char *libraryName, const char *substanceName, void (*ModelicaErrorPtr)(const char *), void (*ModelicaWarningPtr)(const char *));
 
 	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_partialDeriv_state_C_impl(const char *of, const char *wrt, const char *cst, void *state, const char *mediumName, const char *libraryName, const char *substanceName);
 
@@ -231,6 +235,20 @@ extern "C" {
 	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_bubbleEntropy_C_impl(void *sat, const char *mediumName, const char *libraryName, const char *substanceName);
 	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_dewEntropy_C_impl(void *sat, const char *mediumName, const char *libraryName, const char *substanceName);
 
+	/* Call statistics of all solvers, see statistics.h */
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_enableStatistics(int enable);
+	EXTERNALMEDIA_EXPORT void TwoPhaseMedium_resetStatistics(void);
+	EXTERNALMEDIA_EXPORT int TwoPhaseMedium_getStatistics(char *buffer, int size);
+
+	/* Create solvers in advance, see SolverMap::preload */
+	EXTERNALMEDIA_EXPORT int TwoPhaseMedium_preload(const char *spec);
+
+	/* Delete solvers and report their memory, see SolverMap::releaseSolver */
+	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_releaseSolver(const char *mediumName, const char *libraryName, const char *substanceName);
+	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_releaseAll(void);
+	EXTERNALMEDIA_EXPORT double TwoPhaseMedium_memoryUsage(const char *mediumName, const char *libraryName, const char *substanceName);
+	EXTERNALMEDIA_EXPORT int TwoPhaseMedium_getMemoryReport(char *buffer, int size);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,257 @@
+#include "memostore.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*! File format version, part of the header */
+static const unsigned int _formatVersion = 2;
+
+/*! Hash of the ExternalMedia sources, defined by CMake */
+/*!
+  Without it, the build time of this file is used, which does not change
+  with the other sources.
+*/
+#ifndef EXTERNALMEDIA_SOURCE_HASH
+#define EXTERNALMEDIA_SOURCE_HASH 0
+#endif
+/*! Entries per set */
+static const int _nWays = 4;
+
+/*! File header */
+struct MemoHeader{
+	char magic[8];
+	unsigned int version;
+	unsigned int entrySize;
+	unsigned long long nSets;
+	/* Insertion clock shared by all processes, races only make the eviction order approximate */
+	unsigned long long clock;
+	/* Build that stored the entries, see sourceHash */
+	unsigned long long build;
+	char reserved[24];
+};
+
+/*! Stored state, check is 0 for empty entries */
+struct MemoEntry{
+	unsigned long long check;
+	unsigned long long solver;
+	unsigned long long stamp;
+	int function;
+	int phase;
+	double x1, x2;
+	double values[CallTrace::nStateValues];
+};
+
+//! 64 bit FNV-1a hash
+static unsigned long long hashBytes(const void *data, size_t size, unsigned long long hash = 14695981039346656037ULL){
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//! Checksum of an entry, never 0
+static unsigned long long entryCheck(const MemoEntry &entry){
+	unsigned long long check = hashBytes((const char*)&entry + sizeof(entry.check), sizeof(MemoEntry) - sizeof(entry.check));
+	return check ? check : 1;
+}
+
+//! Hash of the lookup key, selects the set
+static unsigned long long keyHash(unsigned long long solver, int function, double x1, double x2, int phase){
+	unsigned long long hash = hashBytes(&solver, sizeof(solver));
+	hash = hashBytes(&function, sizeof(function), hash);
+	hash = hashBytes(&x1, sizeof(x1), hash);
+	hash = hashBytes(&x2, sizeof(x2), hash);
+	hash = hashBytes(&phase, sizeof(phase), hash);
+	// Final mixing, the inputs of nearby states only differ in a few bits
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	return hash ^ (hash >> 33);
+}
+
+//! Hash of the ExternalMedia build
+static unsigned long long sourceHash(){
+	static const unsigned long long hash = EXTERNALMEDIA_SOURCE_HASH ? EXTERNALMEDIA_SOURCE_HASH : hashBytes(__DATE__ " " __TIME__, strlen(__DATE__ " " __TIME__));
+	return hash;
+}
+
+MemoStore::MemoStore() : _mapping(NULL), _mappingSize(0), _nSets(0){
+}
+
+//! Return the store named by the environment, NULL if there is none
+MemoStore *MemoStore::instance(){
+	static MemoStore *store = []() -> MemoStore* {
+		const char *fileName = getenv("EXTERNALMEDIA_MEMO_STORE");
+		if (!fileName || !strlen(fileName))
+			return NULL;
+		const char *sizeValue = getenv("EXTERNALMEDIA_MEMO_SIZE");
+		double megabytes = sizeValue ? strtod(sizeValue, NULL) : 64;
+		if (!(megabytes >= 1))
+			megabytes = 64;
+		MemoStore *newStore = new MemoStore();
+		if (!newStore->open(fileName, (size_t)(megabytes*1048576))){
+			fprintf(stderr, "ExternalMedia: could not open the memo store %s\n", fileName);
+			delete newStore;
+			return NULL;
+		}
+		return newStore;
+	}();
+	return store;
+}
+
+//! Return the hash identifying a solver in the store
+/*!
+  @param solverKey Solver key with the solver options and the versions of
+                   the external library
+*/
+unsigned long long MemoStore::solverHash(const string &solverKey){
+	unsigned long long build = sourceHash();
+	return hashBytes(solverKey.c_str(), solverKey.size(), hashBytes(&build, sizeof(build)));
+}
+
+//! Map the file, a new file is created with the given size
+bool MemoStore::open(const string &fileName, size_t size){
+	size_t nSets = (size - sizeof(MemoHeader))/(_nWays*sizeof(MemoEntry));
+	if (nSets < 1)
+		return false;
+	size = sizeof(MemoHeader) + nSets*_nWays*sizeof(MemoEntry);
+	MemoHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "EMMEMO", 7);
+	header.version = _formatVersion;
+	header.entrySize = sizeof(MemoEntry);
+	header.nSets = nSets;
+	header.build = sourceHash();
+#ifdef WIN32
+	// A new file is created empty and initialized by the first process that maps it
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)){
+		CloseHandle(file);
+		return false;
+	}
+	if (fileSize.QuadPart > 0)
+		size = (size_t)fileSize.QuadPart;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xffffffff), NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+	_mapping = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!_mapping)
+		return false;
+	if (fileSize.QuadPart == 0)
+		memcpy(_mapping, &header, sizeof(header));
+#else
+	// A new file is prepared under a temporary name, so that other processes never see it without header
+	int fd = ::open(fileName.c_str(), O_RDWR);
+	if (fd < 0){
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%lu.tmp", (unsigned long)getpid());
+		string temporary = fileName + suffix;
+		fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+			return false;
+		bool ok = ftruncate(fd, (off_t)size) == 0 && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+		// link fails if another process created the file in the meantime, that file is used
+		ok = ok && (link(temporary.c_str(), fileName.c_str()) == 0 || errno == EEXIST);
+		::close(fd);
+		unlink(temporary.c_str());
+		if (!ok)
+			return false;
+		fd = ::open(fileName.c_str(), O_RDWR);
+		if (fd < 0)
+			return false;
+	}
+	struct stat info;
+	void *view = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(MemoHeader))
+		view = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	_mapping = (char*)view;
+	size = (size_t)info.st_size;
+#endif
+	_mappingSize = size;
+	// The size of an existing file is kept, it has to match its header
+	const MemoHeader *fileHeader = (const MemoHeader*)_mapping;
+	if (memcmp(fileHeader->magic, header.magic, sizeof(header.magic)) || fileHeader->version != _formatVersion
+		|| fileHeader->entrySize != sizeof(MemoEntry) || sizeof(MemoHeader) + fileHeader->nSets*_nWays*sizeof(MemoEntry) != _mappingSize){
+#ifdef WIN32
+		UnmapViewOfFile(_mapping);
+#else
+		munmap(_mapping, _mappingSize);
+#endif
+		_mapping = NULL;
+		return false;
+	}
+	_nSets = fileHeader->nSets;
+	// The states of another build are discarded, processes of that build may still add some
+	if (fileHeader->build != header.build){
+		memset(_mapping + sizeof(MemoHeader), 0, _mappingSize - sizeof(MemoHeader));
+		((MemoHeader*)_mapping)->build = header.build;
+	}
+	return true;
+}
+
+//! Look up a state
+/*!
+  @param solver Solver hash, see solverHash
+  @param function setState function
+  @param x1 First input
+  @param x2 Second input
+  @param phase Phase input
+  @param properties Output state, only written if the state is found
+  @return true if the state was found
+*/
+bool MemoStore::find(unsigned long long solver, Statistics::Function function, double x1, double x2, int phase, ExternalThermodynamicState *const properties){
+	const MemoEntry *set = (const MemoEntry*)(_mapping + sizeof(MemoHeader)) + (keyHash(solver, function, x1, x2, phase) % _nSets)*_nWays;
+	for (int i = 0; i < _nWays; i++){
+		// Work on a copy, other processes may write the entry at the same time
+		MemoEntry entry;
+		memcpy(&entry, &set[i], sizeof(entry));
+		if (entry.check && entry.solver == solver && entry.function == (int)function && entry.phase == phase
+			&& !memcmp(&entry.x1, &x1, sizeof(x1)) && !memcmp(&entry.x2, &x2, sizeof(x2)) && entry.check == entryCheck(entry)){
+			CallTrace::setStateValues(entry.values, properties);
+			return true;
+		}
+	}
+	return false;
+}
+
+//! Store a state, replacing the oldest entry of its set
+void MemoStore::insert(unsigned long long solver, Statistics::Function function, double x1, double x2, int phase, const ExternalThermodynamicState *properties){
+	MemoHeader *header = (MemoHeader*)_mapping;
+	MemoEntry *set = (MemoEntry*)(_mapping + sizeof(MemoHeader)) + (keyHash(solver, function, x1, x2, phase) % _nSets)*_nWays;
+	int oldest = 0;
+	for (int i = 1; i < _nWays && set[oldest].check; i++){
+		if (!set[i].check || set[i].stamp < set[oldest].stamp)
+			oldest = i;
+	}
+	MemoEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.solver = solver;
+	entry.stamp = ++header->clock;
+	entry.function = function;
+	entry.phase = phase;
+	entry.x1 = x1;
+	entry.x2 = x2;
+	CallTrace::stateValues(properties, entry.values);
+	entry.check = entryCheck(entry);
+	memcpy(&set[oldest], &entry, sizeof(entry));
+}
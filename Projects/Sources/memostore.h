@@ -0,0 +1,49 @@
+#ifndef MEMOSTORE_H_
+#define MEMOSTORE_H_
+
+#include "include.h"
+#include "externalmedialib.h"
+#include "statistics.h"
+
+/*! Persistent store of computed states */
+/*!
+  Parameter sweeps and optimization loops run the same model many times,
+  and large parts of the property calls, like the initialization and the
+  boundary conditions, are the same in every run. When the environment
+  variable EXTERNALMEDIA_MEMO_STORE names a file, the states computed by
+  setState_* are stored in that file, keyed by the solver, the function,
+  the inputs and the phase, and later runs look them up instead of calling
+  the equation of state. EXTERNALMEDIA_MEMO_SIZE sets the size of a new
+  file in MB, 64 by default, the size of an existing file is kept.
+
+  The file is memory-mapped and can be used by several processes at the
+  same time. It is a hash table of sets of entries, a new entry replaces
+  the oldest one of its set. Every entry has a checksum, entries that were
+  torn by concurrent writers are ignored. The inputs have to match bit for
+  bit, the solver key includes the solver options and the CoolProp version.
+  The header holds a hash of the ExternalMedia sources the library was built
+  from, see EXTERNALMEDIA_SOURCE_HASH, and a library built from other sources
+  empties the file when opening it. The hash is also part of every solver
+  hash, so that processes of different builds sharing a file never see the
+  states of each other.
+*/
+class MemoStore{
+public:
+	static MemoStore *instance();
+	static unsigned long long solverHash(const string &solverKey);
+
+	bool find(unsigned long long solver, Statistics::Function function, double x1, double x2, int phase, ExternalThermodynamicState *const properties);
+	void insert(unsigned long long solver, Statistics::Function function, double x1, double x2, int phase, const ExternalThermodynamicState *properties);
+
+protected:
+	MemoStore();
+	bool open(const string &fileName, size_t size);
+
+	/*! Mapped file */
+	char *_mapping;
+	size_t _mappingSize;
+	/*! Number of sets of the hash table */
+	unsigned long long _nSets;
+};
+
+#endif /* MEMOSTORE_H_ */
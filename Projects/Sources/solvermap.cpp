@@ -2,6 +2,13 @@
 #include "basesolver.h"
 #include "testsolver.h"
 #include "include.h"
+#include "statistics.h"
+#include "errorhandling.h"
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #if (EXTERNALMEDIA_FLUIDPROP == 1)
 #include "fluidpropsolver.h"
@@ -15,9 +22,7 @@
 /*!
   This function returns the solver for the specified library name, substance name
   and possibly medium name. It creates a new solver if the solver does not already
-  exist. When implementing new solvers, one has to add the newly created solvers to
-  this function. An error message is generated if the specific library is not supported
-  by the interface library.
+  exist.
   @param mediumName Medium name
   @param libraryName Library name
   @param substanceName Substance name
@@ -26,23 +31,47 @@ BaseSolver *SolverMap::getSolver(const string &mediumName, const string &library
 	// Get solver key from library and substance name
 	string solverKeyString(solverKey(libraryName, substanceName));
 	// Check whether solver already exists
-	if (_solvers.find(solverKeyString) != _solvers.end())
-		return _solvers[solverKeyString];
+	map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.find(solverKeyString);
+	if (solver != _solvers.end())
+		return solver->second.get();
+	// Create the media of the preload file first, the solver may be one of them
+	if (preloadEnvironment()){
+		solver = _solvers.find(solverKeyString);
+		if (solver != _solvers.end())
+			return solver->second.get();
+	}
 	// Create new solver if it doesn't exist
+	BaseSolver *newSolver = createSolver(mediumName, libraryName, substanceName);
+	_solvers[solverKeyString].reset(newSolver);
+	return newSolver;
+};
+
+//! Create a new solver
+/*!
+  When implementing new solvers, one has to add the newly created solvers to
+  this function. An error message is generated if the specific library is not
+  supported by the interface library.
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+*/
+BaseSolver *SolverMap::createSolver(const string &mediumName, const string &libraryName, const string &substanceName){
+	BaseSolver *solver = NULL;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	// Test solver for compiler setup debugging
 	if (libraryName.compare("TestMedium") == 0)
-	  _solvers[solverKeyString] = new TestSolver(mediumName, libraryName, substanceName);
-	
+	  solver = new TestSolver(mediumName, libraryName, substanceName);
+
 #if (EXTERNALMEDIA_FLUIDPROP == 1)
 	// FluidProp solver
 	else if (libraryName.find("FluidProp") == 0)
-	  _solvers[solverKeyString] = new FluidPropSolver(mediumName, libraryName, substanceName);
+	  solver = new FluidPropSolver(mediumName, libraryName, substanceName);
 #endif // FLUIDPROP == 1
 
 #if (EXTERNALMEDIA_COOLPROP == 1)
 	// CoolProp solver
 	else if (libraryName.find("CoolProp") == 0)
-	  _solvers[solverKeyString] = new CoolPropSolver(mediumName, libraryName, substanceName);
+	  solver = new CoolPropSolver(mediumName, libraryName, substanceName);
 #endif // COOLPROP == 1
 
 	else {
@@ -51,10 +80,263 @@ BaseSolver *SolverMap::getSolver(const string &mediumName, const string &library
 	  sprintf(error, "Error: libraryName = %s is not supported by any external solver\n", libraryName.c_str());
 	  errorMessage(error);
 	}
-	// Return pointer to solver
-	return _solvers[solverKeyString];
+	// Record the construction time, the solver registered itself in the statistics
+	if (Statistics::enabled() && solver)
+		Statistics::record(solver->statisticsIndex(), Statistics::createSolver,
+			std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	return solver;
+}
+
+//! Get the fluid constants of a solver
+/*!
+  The fluid constants are usually needed at translation and initialization
+  time, before any property is computed. If the solver does not exist yet and
+  the library can provide the constants without it, they are kept in a table
+  and the solver is only created by the first property call.
+  @param mediumName Medium name
+  @param libraryName Library name
+  @param substanceName Substance name
+*/
+const FluidConstants &SolverMap::getFluidConstants(const string &mediumName, const string &libraryName, const string &substanceName){
+	string solverKeyString(solverKey(libraryName, substanceName));
+	map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.find(solverKeyString);
+	if (solver != _solvers.end())
+		return solver->second->fluidConstants();
+	if (preloadEnvironment()){
+		solver = _solvers.find(solverKeyString);
+		if (solver != _solvers.end())
+			return solver->second->fluidConstants();
+	}
+	map<string, FluidConstants>::iterator constants = _constants.find(solverKeyString);
+	if (constants != _constants.end())
+		return constants->second;
+
+#if (EXTERNALMEDIA_COOLPROP == 1)
+	FluidConstants fluidConstants;
+	if (libraryName.find("CoolProp") == 0 && CoolPropSolver::fluidConstants(libraryName, substanceName, fluidConstants))
+		return _constants[solverKeyString] = fluidConstants;
+#endif // COOLPROP == 1
+
+	return getSolver(mediumName, libraryName, substanceName)->fluidConstants();
+}
+
+/* Solver created by preload */
+struct PreloadTask{
+	string libraryName, substanceName;
+	std::unique_ptr<BaseSolver> solver;
+	string error;
+	std::vector<string> warnings;
 };
 
+//! Remove leading and trailing white space
+static string trim(const string &text){
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == string::npos)
+		return "";
+	return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+//! Create solvers in advance
+/*!
+  The solvers are created with their tables and caches, so that none of them
+  is created by a time-critical call of the simulation. They are created one
+  after the other in the calling thread, since the external libraries do not
+  guarantee that solvers can be created concurrently. Setting
+  EXTERNALMEDIA_PRELOAD_THREADS to a number larger than one creates them on
+  that many worker threads instead, for libraries known to be thread-safe;
+  the first solver is still created in the calling thread, since the
+  external libraries load their shared data with the first solver.
+  Solvers that already exist are skipped. Errors do not abort the
+  simulation, they are reported as warnings and the solver is created again
+  by its first call.
+  @param spec Media separated by semicolons or new lines, each one given as
+              libraryName,substanceName; text after # is a comment
+  @return Number of media that could not be created
+*/
+int SolverMap::preload(const string &spec){
+	int failures = 0;
+	std::vector<PreloadTask> tasks;
+	std::istringstream lines(spec);
+	string line;
+	while (std::getline(lines, line)){
+		std::istringstream entries(line.substr(0, line.find('#')));
+		string entry;
+		while (std::getline(entries, entry, ';')){
+			entry = trim(entry);
+			if (entry.empty())
+				continue;
+			size_t comma = entry.find(',');
+			if (comma == string::npos){
+				warningMessage((char*)("Preload entry " + entry + " is not of the form libraryName,substanceName").c_str());
+				failures++;
+				continue;
+			}
+			PreloadTask task;
+			task.libraryName = trim(entry.substr(0, comma));
+			task.substanceName = trim(entry.substr(comma + 1));
+			string key(solverKey(task.libraryName, task.substanceName));
+			bool known = (_solvers.find(key) != _solvers.end());
+			for (size_t i = 0; i < tasks.size() && !known; i++)
+				known = (solverKey(tasks[i].libraryName, tasks[i].substanceName) == key);
+			if (!known)
+				tasks.push_back(std::move(task));
+		}
+	}
+	if (tasks.empty())
+		return failures;
+
+	// The Modelica utility functions must not be called by the workers, messages are replayed below
+	auto create = [](PreloadTask &task){
+		ErrorCapture capture;
+		try {
+			task.solver.reset(createSolver(task.substanceName, task.libraryName, task.substanceName));
+			task.solver->warmUp();
+		} catch (std::exception &e) {
+			task.error = e.what();
+		} catch (...) {
+			task.error = "unknown error";
+		}
+		if (!task.error.empty())
+			task.solver.reset();
+		task.warnings.swap(capture.warnings);
+	};
+	create(tasks[0]);
+	std::atomic<size_t> next(1);
+	auto worker = [&tasks, &next, &create](){
+		for (size_t i = next++; i < tasks.size(); i = next++)
+			create(tasks[i]);
+	};
+	const char *threadsValue = getenv("EXTERNALMEDIA_PRELOAD_THREADS");
+	long nThreads = threadsValue ? strtol(threadsValue, NULL, 10) : 1;
+	if (nThreads > (long)std::thread::hardware_concurrency() && std::thread::hardware_concurrency() > 0)
+		nThreads = std::thread::hardware_concurrency();
+	if (nThreads > (long)tasks.size() - 1)
+		nThreads = tasks.size() - 1;
+	if (nThreads <= 1)
+		worker();
+	else {
+		std::vector<std::thread> threads;
+		for (long i = 0; i < nThreads; i++)
+			threads.push_back(std::thread(worker));
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	for (size_t i = 0; i < tasks.size(); i++){
+		for (size_t j = 0; j < tasks[i].warnings.size(); j++)
+			warningMessage((char*)tasks[i].warnings[j].c_str());
+		if (tasks[i].solver)
+			_solvers[solverKey(tasks[i].libraryName, tasks[i].substanceName)] = std::move(tasks[i].solver);
+		else {
+			warningMessage((char*)("Could not preload " + solverKey(tasks[i].libraryName, tasks[i].substanceName) + ": " + tasks[i].error).c_str());
+			failures++;
+		}
+	}
+	return failures;
+}
+
+//! Create the media of the preload file
+/*!
+  The media of the file named by EXTERNALMEDIA_PRELOAD are created by the
+  first call that needs a solver or its fluid constants, usually at
+  translation or initialization time.
+  @return true if the media were created by this call
+*/
+bool SolverMap::preloadEnvironment(){
+	if (_preloadSpec.empty())
+		return false;
+	string spec;
+	spec.swap(_preloadSpec);
+	preload(spec);
+	return true;
+}
+
+//! Delete a solver
+/*!
+  The solver is deleted with its states, tables and caches, and is created
+  again by the next call for the medium. The solver must not be used by
+  calls running in other threads. Tables kept by the external library
+  itself, like the CoolProp tabular data, are not released.
+  @param libraryName Library name
+  @param substanceName Substance name
+  @return Approximate number of bytes released, 0 if the solver does not exist
+*/
+size_t SolverMap::releaseSolver(const string &libraryName, const string &substanceName){
+	string solverKeyString(solverKey(libraryName, substanceName));
+	_constants.erase(solverKeyString);
+	map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.find(solverKeyString);
+	if (solver == _solvers.end())
+		return 0;
+	size_t bytes = solver->second->memoryFootprint().total();
+	_solvers.erase(solver);
+	return bytes;
+}
+
+//! Delete all solvers
+/*!
+  See releaseSolver.
+  @return Approximate number of bytes released
+*/
+size_t SolverMap::releaseAll(){
+	size_t bytes = 0;
+	for (map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.begin(); solver != _solvers.end(); ++solver)
+		bytes += solver->second->memoryFootprint().total();
+	_solvers.clear();
+	_constants.clear();
+	return bytes;
+}
+
+//! Approximate number of bytes held by a solver
+/*!
+  @param libraryName Library name
+  @param substanceName Substance name
+  @return Bytes held by the solver, 0 if the solver does not exist
+*/
+size_t SolverMap::memoryUsage(const string &libraryName, const string &substanceName){
+	map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.find(solverKey(libraryName, substanceName));
+	return solver != _solvers.end() ? solver->second->memoryFootprint().total() : 0;
+}
+
+//! Escape a string for JSON output
+static string jsonString(const string &value){
+	string escaped = "\"";
+	for (size_t i = 0; i < value.size(); i++){
+		if (value[i] == '"' || value[i] == '\\')
+			escaped += '\\';
+		escaped += value[i];
+	}
+	return escaped + "\"";
+}
+
+//! Return the memory footprint of all solvers as JSON
+/*!
+  The approximate number of bytes is given for each solver, broken down
+  into the states and tables of the external library, the tables built by
+  the solver and the solver caches, see MemoryFootprint.
+*/
+string SolverMap::memoryReport(){
+	std::ostringstream json;
+	MemoryFootprint sum;
+	bool first = true;
+	json << "{\n  \"solvers\": [";
+	for (map<string, std::unique_ptr<BaseSolver> >::iterator solver = _solvers.begin(); solver != _solvers.end(); ++solver){
+		if (!solver->second)
+			continue;
+		MemoryFootprint footprint = solver->second->memoryFootprint();
+		json << (first ? "\n" : ",\n") << "    {\"solver\": " << jsonString(solver->first)
+		     << ", \"states\": " << footprint.states << ", \"tables\": " << footprint.tables
+		     << ", \"nativeTables\": " << footprint.nativeTables << ", \"caches\": " << footprint.caches
+		     << ", \"total\": " << footprint.total() << "}";
+		sum.states += footprint.states;
+		sum.tables += footprint.tables;
+		sum.nativeTables += footprint.nativeTables;
+		sum.caches += footprint.caches;
+		first = false;
+	}
+	json << (first ? "],\n" : "\n  ],\n") << "  \"total\": " << sum.total() << "\n}\n";
+	return json.str();
+}
+
 //! Generate a unique solver key
 /*!
   This function generates a unique solver key based on the library name and
@@ -65,4 +347,53 @@ string SolverMap::solverKey(const string &libraryName, const string &substanceNa
 	return libraryName + "." + substanceName;
 }
 
-map<string, BaseSolver*> SolverMap::_solvers;
+map<string, std::unique_ptr<BaseSolver> > &SolverMap::_solvers = *new map<string, std::unique_ptr<BaseSolver> >;
+map<string, FluidConstants> SolverMap::_constants;
+string SolverMap::_preloadSpec;
+
+/*! Setup from the environment */
+/*!
+  Reads the preload file named by EXTERNALMEDIA_PRELOAD when the library is
+  loaded. The solvers are not created here: the external libraries may not
+  be initialized yet while the library is loading, and on Windows threads
+  cannot be waited for while a library is loading.
+*/
+class PreloadEnvironment{
+public:
+	PreloadEnvironment(){
+		const char *fileName = getenv("EXTERNALMEDIA_PRELOAD");
+		if (!fileName || !strlen(fileName))
+			return;
+		std::ifstream file(fileName);
+		if (!file){
+			fprintf(stderr, "ExternalMedia: could not open the preload file %s\n", fileName);
+			return;
+		}
+		std::ostringstream spec;
+		spec << file.rdbuf();
+		SolverMap::_preloadSpec = spec.str();
+	}
+};
+
+static PreloadEnvironment _environment;
+
+/*! Memory report from the environment */
+/*!
+  Writes the memory report to the file named by EXTERNALMEDIA_MEMORY when
+  the library is unloaded, while the solvers that were not released still
+  exist.
+*/
+class MemoryReportEnvironment{
+public:
+	~MemoryReportEnvironment(){
+		const char *fileName = getenv("EXTERNALMEDIA_MEMORY");
+		if (!fileName || !strlen(fileName))
+			return;
+		string json = SolverMap::memoryReport();
+		FILE *file = fopen(fileName, "w");
+		if (!file || fwrite(json.c_str(), 1, json.size(), file) != json.size() || fclose(file) != 0)
+			fprintf(stderr, "ExternalMedia: could not write the memory report to %s\n", fileName);
+	}
+};
+
+static MemoryReportEnvironment _memoryEnvironment;
@@ -2,6 +2,8 @@
 #define SOLVERMAP_H_
 
 #include "include.h"
+#include "fluidconstants.h"
+#include <memory>
 
 class BaseSolver;
 
@@ -18,11 +20,31 @@ class BaseSolver;
 class SolverMap{
 public:
 	static BaseSolver *getSolver(const string &mediumName, const string &libraryName, const string &substanceName);
+	static const FluidConstants &getFluidConstants(const string &mediumName, const string &libraryName, const string &substanceName);
 	static string solverKey(const string &libraryName, const string &substanceName);
+	static int preload(const string &spec);
+	static size_t releaseSolver(const string &libraryName, const string &substanceName);
+	static size_t releaseAll();
+	static size_t memoryUsage(const string &libraryName, const string &substanceName);
+	static string memoryReport();
 
 protected:
-   /*! Map for all solver instances identified by the SolverKey */
-	static map<string, BaseSolver*> _solvers;
+	static BaseSolver *createSolver(const string &mediumName, const string &libraryName, const string &substanceName);
+	static bool preloadEnvironment();
+
+	/*! Map for all solver instances identified by the SolverKey */
+	/*!
+	  The map owns the solvers. It is never destroyed, so the solvers that are
+	  not released are not deleted at process exit, when the external
+	  libraries may already be shut down.
+	*/
+	static map<string, std::unique_ptr<BaseSolver> > &_solvers;
+	/*! Fluid constants of the solvers that were not created, identified by the SolverKey */
+	static map<string, FluidConstants> _constants;
+	/*! Media of the preload file that were not created yet, see preload */
+	static string _preloadSpec;
+
+	friend class PreloadEnvironment;
 };
 
 #endif /* SOLVERMAP_H_ */
@@ -0,0 +1,283 @@
+#include "statistics.h"
+#include "basesolver.h"
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! Counters of one function */
+struct CallCounters{
+	std::atomic<unsigned long long> calls;
+	std::atomic<unsigned long long> nanoseconds;
+	std::atomic<unsigned long long> histogram[Statistics::nBuckets];
+};
+
+/*! Counters of one solver in one thread */
+/*!
+  Only the owning thread adds to the counters, other threads read them
+  when the statistics are aggregated. The blocks are never freed, so that
+  the counters of finished threads are still part of the statistics.
+*/
+struct SolverCounters{
+	SolverCounters(int solverIndex) : solverIndex(solverIndex){
+		for (int i = 0; i < Statistics::nFunctions; i++){
+			functions[i].calls = 0;
+			functions[i].nanoseconds = 0;
+			for (int j = 0; j < Statistics::nBuckets; j++)
+				functions[i].histogram[j] = 0;
+		}
+		for (int i = 0; i < Statistics::nEvents; i++)
+			events[i] = 0;
+	}
+	int solverIndex;
+	CallCounters functions[Statistics::nFunctions];
+	std::atomic<unsigned long long> events[Statistics::nEvents];
+};
+
+static const char *_functionNames[Statistics::nFunctions] = {
+	"createSolver",
+	"createSolver_options", "createSolver_factory", "createSolver_constants", "createSolver_nearCritical",
+	"setState_ph", "setState_pT", "setState_dT", "setState_ps", "setState_hs", "setState_du", "setState_dh",
+	"partialDeriv_state",
+	"prandtlNumber", "temperature", "velocityOfSound", "isobaricExpansionCoefficient",
+	"specificHeatCapacityCp", "specificHeatCapacityCv", "density", "density_derh_p", "density_derp_h",
+	"dynamicViscosity", "specificEnthalpy", "isothermalCompressibility", "thermalConductivity",
+	"pressure", "specificEntropy", "density_ph_der", "isentropicEnthalpy",
+	"setSat_p", "setSat_T", "setBubbleState", "setDewState",
+	"saturationTemperature", "saturationTemperature_derp", "saturationTemperature_derp_sat",
+	"dBubbleDensity_dPressure", "dDewDensity_dPressure", "dBubbleEnthalpy_dPressure", "dDewEnthalpy_dPressure",
+	"bubbleDensity", "dewDensity", "bubbleEnthalpy", "dewEnthalpy", "saturationPressure", "surfaceTension",
+	"bubbleEntropy", "dewEntropy"
+};
+
+static const char *_eventNames[Statistics::nEvents] = {
+	"taylorHit", "taylorMiss", "failureCacheHit", "failureCacheStore", "flashBudgetHit", "flashApproximated",
+	"fallbackGuessesHit", "fallbackGuessesMiss", "fallbackPhaseHit", "fallbackPhaseMiss", "fallbackEosHit", "fallbackEosMiss",
+	"memoHit", "memoMiss", "twoPhaseCacheHit", "twoPhaseCacheMiss"
+};
+
+/* Registry of solver keys and counter blocks of all threads, guarded by _registryMutex */
+static std::mutex _registryMutex;
+static std::vector<string> _solverKeys;
+static std::vector<SolverCounters*> _counters;
+
+std::atomic<bool> Statistics::_enabled(false);
+
+//! Enable or disable collecting statistics
+void Statistics::enable(bool on){
+	_enabled.store(on);
+}
+
+//! Set all counters to zero
+/*!
+  Calls that are running in other threads while resetting may still be
+  added to the old counts.
+*/
+void Statistics::reset(){
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	for (size_t k = 0; k < _counters.size(); k++){
+		for (int i = 0; i < nFunctions; i++){
+			CallCounters &c = _counters[k]->functions[i];
+			c.calls.store(0, std::memory_order_relaxed);
+			c.nanoseconds.store(0, std::memory_order_relaxed);
+			for (int j = 0; j < nBuckets; j++)
+				c.histogram[j].store(0, std::memory_order_relaxed);
+		}
+		for (int i = 0; i < nEvents; i++)
+			_counters[k]->events[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+//! Return the index of a solver in the statistics
+/*!
+  Solvers created again with the same key share their statistics.
+  @param solverKey Solver key, see SolverMap::solverKey
+*/
+int Statistics::registerSolver(const string &solverKey){
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	for (size_t i = 0; i < _solverKeys.size(); i++)
+		if (_solverKeys[i] == solverKey)
+			return (int)i;
+	_solverKeys.push_back(solverKey);
+	return (int)_solverKeys.size() - 1;
+}
+
+//! Return the key a solver was registered with
+string Statistics::solverKey(int solverIndex){
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	return _solverKeys[solverIndex];
+}
+
+//! Return the counter block of a solver for the calling thread
+static SolverCounters *threadCounters(int solverIndex){
+	// Counter blocks of the calling thread, indexed by solver
+	static thread_local std::vector<SolverCounters*> counterBlocks;
+	if ((int)counterBlocks.size() <= solverIndex)
+		counterBlocks.resize(solverIndex + 1, NULL);
+	if (!counterBlocks[solverIndex]){
+		SolverCounters *counters = new SolverCounters(solverIndex);
+		std::lock_guard<std::mutex> lock(_registryMutex);
+		_counters.push_back(counters);
+		counterBlocks[solverIndex] = counters;
+	}
+	return counterBlocks[solverIndex];
+}
+
+//! Record one call
+/*!
+  @param solverIndex Solver index returned by registerSolver
+  @param function Called function
+  @param nanoseconds Duration of the call
+*/
+void Statistics::record(int solverIndex, Function function, long long nanoseconds){
+	int bucket = 0;
+	for (long long t = nanoseconds; t > 1 && bucket < nBuckets - 1; t >>= 1)
+		bucket++;
+
+	CallCounters &c = threadCounters(solverIndex)->functions[function];
+	c.calls.fetch_add(1, std::memory_order_relaxed);
+	c.nanoseconds.fetch_add(nanoseconds > 0 ? nanoseconds : 0, std::memory_order_relaxed);
+	c.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+//! Count one event
+/*!
+  @param solver Solver the event belongs to
+  @param event Counted event
+*/
+void Statistics::countEvent(const BaseSolver *solver, Event event){
+	threadCounters(solver->statisticsIndex())->events[event].fetch_add(1, std::memory_order_relaxed);
+}
+
+//! Return the name of an instrumented function
+const char *Statistics::functionName(Function function){
+	return _functionNames[function];
+}
+
+//! Return the name of a counted event
+const char *Statistics::eventName(Event event){
+	return _eventNames[event];
+}
+
+//! Escape a string for JSON output
+static string jsonString(const string &value){
+	string escaped = "\"";
+	for (size_t i = 0; i < value.size(); i++){
+		if (value[i] == '"' || value[i] == '\\')
+			escaped += '\\';
+		escaped += value[i];
+	}
+	return escaped + "\"";
+}
+
+//! Return the aggregated statistics of all threads as JSON
+/*!
+  Only the functions that were called and the events that occurred are
+  listed. The time is in seconds, histogram[i] is the number of calls that
+  took between 2^i and 2^(i+1) nanoseconds, trailing empty buckets are
+  omitted.
+*/
+string Statistics::toJSON(){
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\n  \"solvers\": [";
+	for (size_t s = 0; s < _solverKeys.size(); s++){
+		// Sum the counters of all threads
+		unsigned long long calls[nFunctions] = {0}, nanoseconds[nFunctions] = {0}, histogram[nFunctions][nBuckets] = {{0}}, events[nEvents] = {0};
+		for (size_t k = 0; k < _counters.size(); k++){
+			if (_counters[k]->solverIndex != (int)s)
+				continue;
+			for (int i = 0; i < nFunctions; i++){
+				const CallCounters &c = _counters[k]->functions[i];
+				calls[i] += c.calls.load(std::memory_order_relaxed);
+				nanoseconds[i] += c.nanoseconds.load(std::memory_order_relaxed);
+				for (int j = 0; j < nBuckets; j++)
+					histogram[i][j] += c.histogram[j].load(std::memory_order_relaxed);
+			}
+			for (int i = 0; i < nEvents; i++)
+				events[i] += _counters[k]->events[i].load(std::memory_order_relaxed);
+		}
+
+		json << (s > 0 ? ",\n" : "\n") << "    {\n      \"solver\": " << jsonString(_solverKeys[s]) << ",\n      \"functions\": {";
+		bool first = true;
+		for (int i = 0; i < nFunctions; i++){
+			if (calls[i] == 0)
+				continue;
+			int nUsed = nBuckets;
+			while (nUsed > 0 && histogram[i][nUsed - 1] == 0)
+				nUsed--;
+			json << (first ? "\n" : ",\n") << "        " << jsonString(_functionNames[i])
+			     << ": {\"calls\": " << calls[i]
+			     << ", \"time\": " << nanoseconds[i]*1e-9
+			     << ", \"histogram\": [";
+			for (int j = 0; j < nUsed; j++)
+				json << (j > 0 ? ", " : "") << histogram[i][j];
+			json << "]}";
+			first = false;
+		}
+		json << (first ? "}" : "\n      }") << ",\n      \"events\": {";
+		first = true;
+		for (int i = 0; i < nEvents; i++){
+			if (events[i] == 0)
+				continue;
+			json << (first ? "\n" : ",\n") << "        " << jsonString(_eventNames[i]) << ": " << events[i];
+			first = false;
+		}
+		json << (first ? "}\n    }" : "\n      }\n    }");
+	}
+	json << (_solverKeys.empty() ? "]\n}\n" : "\n  ]\n}\n");
+	return json.str();
+}
+
+//! Write the statistics to a JSON file
+/*!
+  @param fileName Output file name
+  @return false if the file could not be written
+*/
+bool Statistics::writeJSON(const string &fileName){
+	string json = toJSON();
+	FILE *file = fopen(fileName.c_str(), "w");
+	if (!file)
+		return false;
+	bool ok = (fwrite(json.c_str(), 1, json.size(), file) == json.size());
+	return (fclose(file) == 0) && ok;
+}
+
+void StatisticsTimer::start(const BaseSolver *solver, Statistics::Function function){
+	_solverIndex = solver->statisticsIndex();
+	_function = function;
+	_start = std::chrono::steady_clock::now();
+}
+
+void StatisticsTimer::stop(){
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - _start;
+	Statistics::record(_solverIndex, _function, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+/*! Setup from the environment */
+/*!
+  Reads EXTERNALMEDIA_STATISTICS when the library is loaded and writes the
+  JSON file when it is unloaded. This object is destroyed before the
+  registry above.
+*/
+class StatisticsEnvironment{
+public:
+	StatisticsEnvironment(){
+		const char *value = getenv("EXTERNALMEDIA_STATISTICS");
+		if (!value || !strlen(value) || !strcmp(value, "0"))
+			return;
+		Statistics::enable(true);
+		if (strcmp(value, "1"))
+			fileName = value;
+	}
+	~StatisticsEnvironment(){
+		if (!fileName.empty() && !Statistics::writeJSON(fileName))
+			fprintf(stderr, "ExternalMedia: could not write the call statistics to %s\n", fileName.c_str());
+	}
+	string fileName;
+};
+
+static StatisticsEnvironment _environment;
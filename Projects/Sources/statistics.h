@@ -0,0 +1,117 @@
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include "include.h"
+#include <atomic>
+#include <chrono>
+
+class BaseSolver;
+
+/*! Call statistics */
+/*!
+  This class collects call counts, cumulative time and latency histograms
+  for each solver and each function of the C interface, and the time spent
+  in the phases of the solver construction. The histograms have logarithmic
+  buckets, bucket i counts the calls that took between 2^i and 2^(i+1)
+  nanoseconds. Events inside the calls, like the hits and misses of the
+  solver caches, are only counted, see Event.
+
+  The counters are kept per thread and are only aggregated when the
+  statistics are read, so the instrumented calls never wait for each other.
+  Collecting is off by default and costs a single flag check per call.
+  It can be switched on at run time with TwoPhaseMedium_enableStatistics or
+  by setting the environment variable EXTERNALMEDIA_STATISTICS: the value 1
+  enables collecting, any other non-empty value except 0 is used as the name
+  of a JSON file the statistics are written to at process exit.
+*/
+class Statistics{
+public:
+	/*! Instrumented functions, named after the C interface functions */
+	enum Function {
+		createSolver,
+		createSolver_options, createSolver_factory, createSolver_constants, createSolver_nearCritical,
+		setState_ph, setState_pT, setState_dT, setState_ps, setState_hs, setState_du, setState_dh,
+		partialDeriv_state,
+		prandtlNumber, temperature, velocityOfSound, isobaricExpansionCoefficient,
+		specificHeatCapacityCp, specificHeatCapacityCv, density, density_derh_p, density_derp_h,
+		dynamicViscosity, specificEnthalpy, isothermalCompressibility, thermalConductivity,
+		pressure, specificEntropy, density_ph_der, isentropicEnthalpy,
+		setSat_p, setSat_T, setBubbleState, setDewState,
+		saturationTemperature, saturationTemperature_derp, saturationTemperature_derp_sat,
+		dBubbleDensity_dPressure, dDewDensity_dPressure, dBubbleEnthalpy_dPressure, dDewEnthalpy_dPressure,
+		bubbleDensity, dewDensity, bubbleEnthalpy, dewEnthalpy, saturationPressure, surfaceTension,
+		bubbleEntropy, dewEntropy,
+		nFunctions
+	};
+	/*! Counted events of the solvers */
+	enum Event {
+		taylorHit, taylorMiss, failureCacheHit, failureCacheStore, flashBudgetHit, flashApproximated,
+		fallbackGuessesHit, fallbackGuessesMiss, fallbackPhaseHit, fallbackPhaseMiss, fallbackEosHit, fallbackEosMiss,
+		memoHit, memoMiss, twoPhaseCacheHit, twoPhaseCacheMiss,
+		nEvents
+	};
+	/*! Number of latency histogram buckets, the last one also holds all slower calls */
+	static const int nBuckets = 40;
+
+	/*! Return true if statistics are being collected */
+	static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+	static void enable(bool on);
+	static void reset();
+
+	static int registerSolver(const string &solverKey);
+	static string solverKey(int solverIndex);
+	static void record(int solverIndex, Function function, long long nanoseconds);
+	/*! Count one event of a solver, if statistics are being collected */
+	static void count(const BaseSolver *solver, Event event){
+		if (enabled())
+			countEvent(solver, event);
+	}
+
+	static const char *functionName(Function function);
+	static const char *eventName(Event event);
+	static string toJSON();
+	static bool writeJSON(const string &fileName);
+
+protected:
+	static void countEvent(const BaseSolver *solver, Event event);
+
+	/*! Run time switch */
+	static std::atomic<bool> _enabled;
+};
+
+/*! Scoped timer for one instrumented call */
+/*!
+  The call is recorded when the timer goes out of scope. Calls aborted by
+  errorMessage do not return and are not recorded.
+*/
+class StatisticsTimer{
+public:
+	StatisticsTimer(const BaseSolver *solver, Statistics::Function function)
+		: _active(Statistics::enabled()){
+		if (_active)
+			start(solver, function);
+	}
+	~StatisticsTimer(){
+		if (_active)
+			stop();
+	}
+	/*! Record the time so far and start timing the next function or phase */
+	void restart(Statistics::Function function){
+		if (_active){
+			stop();
+			_function = function;
+			_start = std::chrono::steady_clock::now();
+		}
+	}
+
+protected:
+	void start(const BaseSolver *solver, Statistics::Function function);
+	void stop();
+
+	bool _active;
+	int _solverIndex;
+	Statistics::Function _function;
+	std::chrono::steady_clock::time_point _start;
+};
+
+#endif /* STATISTICS_H_ */
@@ -0,0 +1,265 @@
+#include "trace.h"
+#include "basesolver.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! Record types */
+enum TraceRecordType { traceSolver = 1, traceCall = 2 };
+
+/*! Maximum string length in a call record, longer strings are truncated */
+static const size_t _maxTextLength = 255;
+
+//! Append a value to a byte buffer
+template <class T> static char *put(char *buffer, T value){
+	memcpy(buffer, &value, sizeof(T));
+	return buffer + sizeof(T);
+}
+
+//! Append a string to a byte buffer
+static char *putString(char *buffer, const char *text, size_t maxLength){
+	size_t length = strlen(text);
+	if (length > maxLength)
+		length = maxLength;
+	buffer = put<unsigned short>(buffer, (unsigned short)length);
+	memcpy(buffer, text, length);
+	return buffer + length;
+}
+
+/*! Asynchronous trace file writer */
+/*!
+  The calling threads append records to a buffer, a background thread swaps
+  it with a spare buffer and writes it to the file, when it is large enough
+  or at least once per second.
+*/
+class TraceWriter{
+public:
+	TraceWriter(FILE *file);
+	void close();
+	void write(const BaseSolver *solver, int solverIndex, const char *record, size_t size);
+
+protected:
+	void run();
+	void append(const char *data, size_t size);
+
+	/*! Buffer size that wakes up the writer thread */
+	static const size_t _flushSize = 1 << 20;
+
+	FILE *_file;
+	std::mutex _mutex;
+	std::condition_variable _wakeup, _idle;
+	std::vector<char> _buffer, _spare;
+	std::vector<bool> _knownSolvers;
+	bool _stopping, _writing;
+	std::thread _thread;
+};
+
+TraceWriter::TraceWriter(FILE *file) : _file(file), _stopping(false), _writing(false){
+	_buffer.reserve(2*_flushSize);
+	_spare.reserve(2*_flushSize);
+	// File header with the function names
+	char header[64];
+	char *end = header;
+	memcpy(end, "EMTRACE", 8);
+	end = put<unsigned int>(end + 8, CallTrace::version);
+	end = put<unsigned short>(end, Statistics::nFunctions);
+	append(header, end - header);
+	for (int i = 0; i < Statistics::nFunctions; i++){
+		end = putString(header, Statistics::functionName((Statistics::Function)i), sizeof(header) - 2);
+		append(header, end - header);
+	}
+	_thread = std::thread(&TraceWriter::run, this);
+}
+
+//! Write the remaining records and close the file
+/*!
+  On Windows, this runs when the library is unloaded and threads cannot be
+  joined, the writer thread is only waited for. The writer is not deleted,
+  calls still running in other threads are ignored.
+*/
+void TraceWriter::close(){
+	std::unique_lock<std::mutex> lock(_mutex);
+	_stopping = true;
+	_wakeup.notify_all();
+	_idle.wait_for(lock, std::chrono::seconds(10), [this]{ return !_writing; });
+	if (!_writing){
+		fwrite(_buffer.data(), 1, _buffer.size(), _file);
+		fclose(_file);
+	}
+	lock.unlock();
+#ifdef WIN32
+	_thread.detach();
+#else
+	_thread.join();
+#endif
+}
+
+void TraceWriter::append(const char *data, size_t size){
+	_buffer.insert(_buffer.end(), data, data + size);
+}
+
+//! Add a call record, preceded by the solver record for the first call of a solver
+void TraceWriter::write(const BaseSolver *solver, int solverIndex, const char *record, size_t size){
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_stopping)
+		return;
+	if ((int)_knownSolvers.size() <= solverIndex)
+		_knownSolvers.resize(solverIndex + 1, false);
+	if (!_knownSolvers[solverIndex]){
+		// Solvers may reduce their substance name, the one in the solver key is used
+		string substanceName = Statistics::solverKey(solverIndex).substr(solver->libraryName.size() + 1);
+		std::vector<char> solverRecord(9 + solver->mediumName.size() + solver->libraryName.size() + substanceName.size());
+		char *end = put<unsigned char>(solverRecord.data(), traceSolver);
+		end = put<unsigned short>(end, (unsigned short)solverIndex);
+		end = putString(end, solver->mediumName.c_str(), 65535);
+		end = putString(end, solver->libraryName.c_str(), 65535);
+		end = putString(end, substanceName.c_str(), 65535);
+		append(solverRecord.data(), end - solverRecord.data());
+		_knownSolvers[solverIndex] = true;
+	}
+	append(record, size);
+	if (_buffer.size() >= _flushSize)
+		_wakeup.notify_one();
+}
+
+void TraceWriter::run(){
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stopping){
+		_wakeup.wait_for(lock, std::chrono::seconds(1), [this]{ return _stopping || _buffer.size() >= _flushSize; });
+		if (_stopping || _buffer.empty())
+			continue;
+		_buffer.swap(_spare);
+		_writing = true;
+		lock.unlock();
+		fwrite(_spare.data(), 1, _spare.size(), _file);
+		fflush(_file);
+		_spare.clear();
+		lock.lock();
+		_writing = false;
+		_idle.notify_all();
+	}
+}
+
+bool CallTrace::_enabled = false;
+static TraceWriter *_writer = NULL;
+
+//! Encode the call and pass it to the writer
+void CallTrace::commit(){
+	char record[8 + sizeof(_in) + sizeof(_out) + 3*(2 + _maxTextLength)];
+	int solverIndex = _solver->statisticsIndex();
+	char *end = put<unsigned char>(record, traceCall);
+	end = put<unsigned char>(end, (unsigned char)_function);
+	end = put<unsigned short>(end, (unsigned short)solverIndex);
+	end = put<unsigned char>(end, (unsigned char)_nIn);
+	end = put<unsigned char>(end, (unsigned char)_nOut);
+	end = put<unsigned char>(end, (unsigned char)_nText);
+	memcpy(end, _in, _nIn*sizeof(double));
+	end += _nIn*sizeof(double);
+	memcpy(end, _out, _nOut*sizeof(double));
+	end += _nOut*sizeof(double);
+	for (int i = 0; i < _nText; i++)
+		end = putString(end, _text[i], _maxTextLength);
+	_writer->write(_solver, solverIndex, record, end - record);
+}
+
+void CallTrace::stateValues(const ExternalThermodynamicState *state, double *values){
+	values[0] = state->T;
+	values[1] = state->a;
+	values[2] = state->beta;
+	values[3] = state->cp;
+	values[4] = state->cv;
+	values[5] = state->d;
+	values[6] = state->ddhp;
+	values[7] = state->ddph;
+	values[8] = state->eta;
+	values[9] = state->h;
+	values[10] = state->kappa;
+	values[11] = state->lambda;
+	values[12] = state->p;
+	values[13] = state->phase;
+	values[14] = state->s;
+}
+
+void CallTrace::setStateValues(const double *values, ExternalThermodynamicState *state){
+	state->T = values[0];
+	state->a = values[1];
+	state->beta = values[2];
+	state->cp = values[3];
+	state->cv = values[4];
+	state->d = values[5];
+	state->ddhp = values[6];
+	state->ddph = values[7];
+	state->eta = values[8];
+	state->h = values[9];
+	state->kappa = values[10];
+	state->lambda = values[11];
+	state->p = values[12];
+	state->phase = (int)values[13];
+	state->s = values[14];
+}
+
+void CallTrace::satValues(const ExternalSaturationProperties *sat, double *values){
+	values[0] = sat->Tsat;
+	values[1] = sat->dTp;
+	values[2] = sat->ddldp;
+	values[3] = sat->ddvdp;
+	values[4] = sat->dhldp;
+	values[5] = sat->dhvdp;
+	values[6] = sat->dl;
+	values[7] = sat->dv;
+	values[8] = sat->hl;
+	values[9] = sat->hv;
+	values[10] = sat->psat;
+	values[11] = sat->sigma;
+	values[12] = sat->sl;
+	values[13] = sat->sv;
+}
+
+void CallTrace::setSatValues(const double *values, ExternalSaturationProperties *sat){
+	sat->Tsat = values[0];
+	sat->dTp = values[1];
+	sat->ddldp = values[2];
+	sat->ddvdp = values[3];
+	sat->dhldp = values[4];
+	sat->dhvdp = values[5];
+	sat->dl = values[6];
+	sat->dv = values[7];
+	sat->hl = values[8];
+	sat->hv = values[9];
+	sat->psat = values[10];
+	sat->sigma = values[11];
+	sat->sl = values[12];
+	sat->sv = values[13];
+}
+
+/*! Setup from the environment */
+/*!
+  Opens the trace file named by EXTERNALMEDIA_TRACE when the library is
+  loaded and closes it when it is unloaded.
+*/
+class TraceEnvironment{
+public:
+	TraceEnvironment(){
+		const char *fileName = getenv("EXTERNALMEDIA_TRACE");
+		if (!fileName || !strlen(fileName))
+			return;
+		FILE *file = fopen(fileName, "wb");
+		if (!file){
+			fprintf(stderr, "ExternalMedia: could not open the trace file %s\n", fileName);
+			return;
+		}
+		_writer = new TraceWriter(file);
+		CallTrace::_enabled = true;
+	}
+	~TraceEnvironment(){
+		CallTrace::_enabled = false;
+		if (_writer)
+			_writer->close();
+	}
+};
+
+static TraceEnvironment _environment;
@@ -0,0 +1,126 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "include.h"
+#include "externalmedialib.h"
+#include "statistics.h"
+#include <exception>
+
+class BaseSolver;
+
+/*! Call trace recorder */
+/*!
+  When the environment variable EXTERNALMEDIA_TRACE is set to a file name
+  when the library is loaded, every call to the C interface is recorded to
+  that file. A background thread writes the buffered records, so the calling
+  threads only copy a few bytes.
+
+  The trace is a binary file in native byte order:
+  - header: "EMTRACE" and a null byte, uint32 format version, uint16 number
+    of functions followed by the function names (see Statistics::Function)
+  - solver record, before the first call of each solver: uint8 1, uint16
+    solver id, medium, library and substance name
+  - call record: uint8 2, uint8 function id, uint16 solver id, uint8 number
+    of inputs, uint8 number of outputs, uint8 number of strings, the input
+    and output values as doubles and the strings
+  Strings are stored as uint16 length followed by the characters. Input and
+  output records are stored as nStateValues or nSatValues doubles in the
+  order of the struct members, the phase flag is stored as a double.
+  Calls aborted by errorMessage are not recorded, also when ModelicaError
+  throws an exception instead of returning to the simulation tool.
+*/
+class CallTrace{
+public:
+	/*! Trace format version */
+	static const int version = 1;
+	/*! Number of doubles for an ExternalThermodynamicState record */
+	static const int nStateValues = 15;
+	/*! Number of doubles for an ExternalSaturationProperties record */
+	static const int nSatValues = 14;
+
+	/*! Return true if calls are being recorded */
+	static bool enabled() { return _enabled; }
+
+	CallTrace(const BaseSolver *solver, Statistics::Function function)
+		: _active(enabled()), _solver(solver), _function(function), _nIn(0), _nOut(0), _nText(0), _exceptions(uncaughtExceptions()){}
+	~CallTrace(){
+		// A call unwound by an exception has no outputs
+		if (_active && uncaughtExceptions() == _exceptions)
+			commit();
+	}
+
+	void input(double value){
+		if (_active)
+			_in[_nIn++] = value;
+	}
+	void input(int value){
+		if (_active)
+			_in[_nIn++] = value;
+	}
+	void input(const char *text){
+		if (_active)
+			_text[_nText++] = text;
+	}
+	void input(const ExternalThermodynamicState *state){
+		if (_active){
+			stateValues(state, _in + _nIn);
+			_nIn += nStateValues;
+		}
+	}
+	void input(const ExternalSaturationProperties *sat){
+		if (_active){
+			satValues(sat, _in + _nIn);
+			_nIn += nSatValues;
+		}
+	}
+	void output(const ExternalThermodynamicState *state){
+		if (_active){
+			stateValues(state, _out + _nOut);
+			_nOut += nStateValues;
+		}
+	}
+	void output(const ExternalSaturationProperties *sat){
+		if (_active){
+			satValues(sat, _out + _nOut);
+			_nOut += nSatValues;
+		}
+	}
+	/*! Record the returned value and pass it on */
+	double result(double value){
+		if (_active)
+			_out[_nOut++] = value;
+		return value;
+	}
+
+	static void stateValues(const ExternalThermodynamicState *state, double *values);
+	static void setStateValues(const double *values, ExternalThermodynamicState *state);
+	static void satValues(const ExternalSaturationProperties *sat, double *values);
+	static void setSatValues(const double *values, ExternalSaturationProperties *sat);
+
+protected:
+	friend class TraceEnvironment;
+	void commit();
+
+	/*! Number of exceptions being thrown in this thread */
+	static int uncaughtExceptions(){
+#if defined(__cpp_lib_uncaught_exceptions) || (defined(_MSC_VER) && _MSC_VER >= 1900)
+		return std::uncaught_exceptions();
+#else
+		return std::uncaught_exception() ? 1 : 0;
+#endif
+	}
+
+	/*! Set when the library is loaded */
+	static bool _enabled;
+
+	bool _active;
+	const BaseSolver *_solver;
+	Statistics::Function _function;
+	int _nIn, _nOut, _nText;
+	double _in[2*nStateValues];
+	double _out[nStateValues];
+	const char *_text[3];
+	int _exceptions; /* uncaught exceptions when the call started */
+};
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,908 @@
+/*
+  coolprop_fastpaths
+
+  Compares the fast paths of the CoolProp solver with the plain CoolProp
+  results they replace. Each case runs a grid of inputs through the C
+  interface of ExternalMedia with the option that enables the fast path, and
+  through a CoolProp AbstractState with the equivalent plain calls, and
+  reports the points where the relative difference exceeds the tolerance of
+  the case.
+
+  Usage: coolprop_fastpaths [case ...]
+    Runs the given cases, or all of them. The exit code is the number of
+    failed cases. The memo_store and memo_reopen cases run in two processes
+    with EXTERNALMEDIA_MEMO_STORE set to the same new file, and are skipped
+    without it.
+
+  The library is compiled into the test, ModelicaError is implemented by
+  throwing an exception.
+*/
+
+#include "externalmedialib.h"
+#include "CoolProp.h"
+#include "AbstractState.h"
+#include "crossplatform_shared_ptr.h"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define FASTPATHS_EXPORT __declspec(dllexport)
+#else
+#define FASTPATHS_EXPORT
+#endif
+
+using std::string;
+
+/*! Error reported by the library through ModelicaError */
+class FastPathError : public std::runtime_error{
+public:
+	FastPathError(const char *message) : std::runtime_error(message){}
+};
+
+/*! Number of warnings reported by the library */
+static int _warnings = 0;
+
+extern "C" {
+	FASTPATHS_EXPORT void ModelicaError(const char *string){
+		throw FastPathError(string);
+	}
+	FASTPATHS_EXPORT void ModelicaWarning(const char *string){
+		_warnings++;
+	}
+}
+
+/*! Comparison statistics of one case */
+class Comparison{
+public:
+	Comparison(const char *name) : _name(name), _points(0), _failures(0), _maxError(0){}
+
+	/*! Compare a value with its reference, with a relative tolerance */
+	void check(const char *what, double value, double reference, double rtol, double x1, double x2){
+		_points++;
+		double error = fabs(value - reference)/(fabs(reference) > 1e-300 ? fabs(reference) : 1.0);
+		if (error > _maxError || !(error == error))
+			_maxError = error;
+		if (!(error <= rtol)) {
+			if (_failures < 10)
+				printf("  %s: %s at (%.10g, %.10g) is %.10g, reference %.10g, relative error %.3g\n", _name, what, x1, x2, value, reference, error);
+			_failures++;
+		}
+	}
+
+	/*! A point that could not be computed */
+	void fail(const char *what, double x1, double x2, const char *message){
+		_points++;
+		if (_failures < 10)
+			printf("  %s: %s at (%.10g, %.10g) failed: %s\n", _name, what, x1, x2, message);
+		_failures++;
+	}
+
+	/*! Print the summary, return true if all points passed */
+	bool report() const{
+		printf("%-24s %6d points, max relative error %.3g, %s\n", _name, _points, _maxError, _failures ? "FAILED" : "passed");
+		return _failures == 0 && _points > 0;
+	}
+
+private:
+	const char *_name;
+	int _points, _failures;
+	double _maxError;
+};
+
+/*! Sum of the counts of an event over all solvers in the call statistics */
+static long eventCount(const char *event){
+	std::vector<char> buffer(TwoPhaseMedium_getStatistics(NULL, 0) + 1);
+	TwoPhaseMedium_getStatistics(&buffer[0], (int)buffer.size());
+	string key = string("\"") + event + "\": ";
+	long count = 0;
+	for (const char *match = strstr(&buffer[0], key.c_str()); match; match = strstr(match + 1, key.c_str()))
+		count += atol(match + key.size());
+	return count;
+}
+
+/*! Logarithmically spaced pressures between pmin and pmax */
+static std::vector<double> pressureGrid(double pmin, double pmax, int n){
+	std::vector<double> p(n);
+	for (int i = 0; i < n; i++)
+		p[i] = pmin*pow(pmax/pmin, (double)i/(n - 1));
+	return p;
+}
+
+/*! Pressures and temperatures from 0.01 to 2 pc and from 0.7 to 1.5 Tc, within the limits of the equation of state */
+static std::vector<std::pair<double, double> > singlePhaseGrid(shared_ptr<CoolProp::AbstractState> &ref, int nP, int nT){
+	double Tmin = std::max(0.7*ref->T_critical(), ref->Ttriple() + 1), Tmax = std::min(1.5*ref->T_critical(), 0.95*ref->Tmax());
+	std::vector<double> p = pressureGrid(std::max(0.01*ref->p_critical(), 2*ref->p_triple()), 2*ref->p_critical(), nP);
+	std::vector<std::pair<double, double> > states;
+	for (int i = 0; i < nP; i++) {
+		for (int j = 0; j < nT; j++) {
+			double T = Tmin + (Tmax - Tmin)*j/(nT - 1);
+			try {
+				ref->update(CoolProp::PT_INPUTS, p[i], T);
+			} catch (std::exception &) {
+				// Below the melting line
+				continue;
+			}
+			states.push_back(std::make_pair(p[i], T));
+		}
+	}
+	return states;
+}
+
+/*! Smoothed two-phase density derivatives: closed form spline and spline table against first_two_phase_deriv_splined */
+static bool splineCase(){
+	Comparison cmp("spline");
+	const char *fluids[] = {"Water", "R134a"};
+	for (int f = 0; f < 2; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		// Smoothed derivatives or smoothed density, with the closed form or with the table
+		for (int mode = 0; mode < 4; mode++) {
+			bool density = mode & 1, table = mode & 2;
+			double x_end = density ? 0.2 : 0.1;
+			// The table is interpolated up to 0.8 pc within 5e-3, the first pressure
+			// is below the table and is computed in closed form
+			std::vector<double> p = pressureGrid(ref->p_triple()*1.1, ref->p_critical()*(table ? 0.8 : 0.9), 12);
+			p.insert(p.begin(), ref->p_triple()*1.0005);
+			string substance = string(fluids[f]) + (density ? "|rho_smoothing_xend=0.2" : "|twophase_derivsmoothing_xend=0.1");
+			if (table)
+				substance += "|twophase_spline_table=200";
+			for (size_t i = 0; i < p.size(); i++) {
+				for (int j = 1; j < 10; j += 2) {
+					double Q = x_end*j/10, rtol = table && i > 0 ? 5e-3 : 1e-6;
+					ref->update(CoolProp::PQ_INPUTS, p[i], Q);
+					double h = ref->hmass();
+					double ddph = ref->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iP, CoolProp::iHmass, x_end);
+					double ddhp = ref->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iHmass, CoolProp::iP, x_end);
+					double d = ref->first_two_phase_deriv_splined(CoolProp::iDmass, CoolProp::iDmass, CoolProp::iDmass, x_end);
+					ExternalThermodynamicState state;
+					try {
+						TwoPhaseMedium_setState_ph_C_impl(p[i], h, 0, &state, fluids[f], "CoolProp", substance.c_str());
+					} catch (std::exception &e) {
+						cmp.fail("setState_ph", p[i], Q, e.what());
+						continue;
+					}
+					cmp.check("ddph", state.ddph, ddph, rtol, p[i], Q);
+					cmp.check("ddhp", state.ddhp, ddhp, rtol, p[i], Q);
+					if (density)
+						cmp.check("d", state.d, d, rtol, p[i], Q);
+				}
+			}
+		}
+	}
+	return cmp.report();
+}
+
+/*! Density-based inputs: native two-phase branch of setState_du and setState_dh against the generic d-u and d-h flashes */
+static bool dxCase(){
+	Comparison cmp("dx");
+	const char *fluids[] = {"Water", "R134a", "CO2"};
+	for (int f = 0; f < 3; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		std::vector<double> p = pressureGrid(ref->p_triple()*1.1, ref->p_critical()*0.95, 8);
+		for (size_t i = 0; i < p.size(); i++) {
+			// Two-phase states flagged with phase = 2, and single-phase states on
+			// both sides of the dome with phase = 0 and with a wrong phase = 2
+			for (int j = 0; j < 9; j++) {
+				bool twoPhase = j < 5;
+				ref->update(CoolProp::PQ_INPUTS, p[i], twoPhase ? 0.05 + 0.225*j : 0);
+				double Tsat = ref->T(), dT = (Tsat - ref->Ttriple() < 20) ? 0.5*(Tsat - ref->Ttriple()) : 10;
+				if (!twoPhase)
+					ref->update(CoolProp::PT_INPUTS, p[i], (j & 1) ? Tsat - dT : 1.2*ref->T_critical());
+				double d = ref->rhomass(), u = ref->umass(), h = ref->hmass();
+				for (int input = 0; input < 2; input++) {
+					if (input == 0)
+						ref->update(CoolProp::DmassUmass_INPUTS, d, u);
+					else
+						ref->update(CoolProp::DmassHmass_INPUTS, d, h);
+					for (int flag = twoPhase ? 2 : 0; flag <= 2; flag += 2) {
+						ExternalThermodynamicState state;
+						try {
+							if (input == 0)
+								TwoPhaseMedium_setState_du_C_impl(d, u, flag, &state, fluids[f], "CoolProp", fluids[f]);
+							else
+								TwoPhaseMedium_setState_dh_C_impl(d, h, flag, &state, fluids[f], "CoolProp", fluids[f]);
+						} catch (std::exception &e) {
+							cmp.fail(input ? "setState_dh" : "setState_du", d, input ? h : u, e.what());
+							continue;
+						}
+						cmp.check("T", state.T, ref->T(), 1e-8, d, input ? h : u);
+						cmp.check("p", state.p, ref->p(), 1e-8, d, input ? h : u);
+						cmp.check("h", state.h, ref->hmass(), 1e-8, d, input ? h : u);
+						cmp.check("s", state.s, ref->smass(), 1e-8, d, input ? h : u);
+					}
+				}
+			}
+		}
+	}
+	return cmp.report();
+}
+
+/*! Saturation properties: dew line from the bubble line VLE solve against separate PQ and QT updates */
+static bool sharedVLECase(){
+	Comparison cmp("shared_vle");
+	const char *fluids[] = {"Water", "R134a", "CO2"};
+	for (int f = 0; f < 3; f++) {
+		shared_ptr<CoolProp::AbstractState> L(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		shared_ptr<CoolProp::AbstractState> V(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		const char *substance = fluids[f];
+		std::vector<double> p = pressureGrid(L->p_triple()*1.1, L->p_critical()*0.95, 10);
+		for (size_t i = 0; i < p.size(); i++) {
+			for (int input = 0; input < 2; input++) {
+				ExternalSaturationProperties sat;
+				try {
+					if (input == 0) {
+						L->update(CoolProp::PQ_INPUTS, p[i], 0);
+						V->update(CoolProp::PQ_INPUTS, p[i], 1);
+						TwoPhaseMedium_setSat_p_C_impl(p[i], &sat, fluids[f], "CoolProp", substance);
+					} else {
+						L->update(CoolProp::QT_INPUTS, 0, L->T());
+						V->update(CoolProp::QT_INPUTS, 1, L->T());
+						TwoPhaseMedium_setSat_T_C_impl(L->T(), &sat, fluids[f], "CoolProp", substance);
+					}
+				} catch (std::exception &e) {
+					cmp.fail(input ? "setSat_T" : "setSat_p", p[i], input, e.what());
+					continue;
+				}
+				cmp.check("Tsat", sat.Tsat, L->T(), 1e-9, p[i], input);
+				cmp.check("dl", sat.dl, L->rhomass(), 1e-9, p[i], input);
+				cmp.check("hl", sat.hl, L->hmass(), 1e-9, p[i], input);
+				cmp.check("dv", sat.dv, V->rhomass(), 1e-8, p[i], input);
+				cmp.check("hv", sat.hv, V->hmass(), 1e-8, p[i], input);
+				cmp.check("sv", sat.sv, V->smass(), 1e-8, p[i], input);
+				cmp.check("ddvdp", sat.ddvdp, V->first_saturation_deriv(CoolProp::iDmass, CoolProp::iP), 1e-6, p[i], input);
+				cmp.check("dhvdp", sat.dhvdp, V->first_saturation_deriv(CoolProp::iHmass, CoolProp::iP), 1e-6, p[i], input);
+				// The record carries the surface tension as well
+				cmp.check("sat.sigma", sat.sigma, L->surface_tension(), 1e-9, p[i], input);
+				cmp.check("sigma", TwoPhaseMedium_surfaceTension_C_impl(&sat, fluids[f], "CoolProp", substance), L->surface_tension(), 1e-9, p[i], input);
+			}
+		}
+	}
+	return cmp.report();
+}
+
+/*! Bubble and dew states from the saturation record against the p-h flash at the same points */
+static bool bubbleDewCase(){
+	Comparison cmp("bubble_dew");
+	const char *fluids[] = {"Water", "R134a", "CO2"};
+	for (int f = 0; f < 3; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		std::vector<double> p = pressureGrid(ref->p_triple()*1.1, ref->p_critical()*0.95, 10);
+		for (size_t i = 0; i < p.size(); i++) {
+			ExternalSaturationProperties sat;
+			try {
+				TwoPhaseMedium_setSat_p_C_impl(p[i], &sat, fluids[f], "CoolProp", fluids[f]);
+			} catch (std::exception &e) {
+				cmp.fail("setSat_p", p[i], 0, e.what());
+				continue;
+			}
+			for (int Q = 0; Q < 2; Q++) {
+				for (int phase = 1; phase <= 2; phase++) {
+					// The flash inputs are on the side of the dome given by the phase, at dh
+					// and 2 dh from the saturated enthalpy, and the reference is extrapolated
+					// linearly to the saturated enthalpy. On the single-phase side, dh is
+					// _delta_h of the solver, closer inputs are flashed as two-phase. On the
+					// two-phase side, _delta_h changes the density by up to 1% at low
+					// pressures, so the offset is smaller.
+					double h = (Q == 0) ? sat.hl : sat.hv;
+					double dh = (phase == 1) ? 1e-1 : 1e-3;
+					if ((Q == 0) == (phase == 1))
+						dh = -dh;
+					ExternalThermodynamicState state, flash1, flash2;
+					try {
+						if (Q == 0)
+							TwoPhaseMedium_setBubbleState_C_impl(&sat, phase, &state, fluids[f], "CoolProp", fluids[f]);
+						else
+							TwoPhaseMedium_setDewState_C_impl(&sat, phase, &state, fluids[f], "CoolProp", fluids[f]);
+						TwoPhaseMedium_setState_ph_C_impl(sat.psat, h + dh, phase, &flash1, fluids[f], "CoolProp", fluids[f]);
+						TwoPhaseMedium_setState_ph_C_impl(sat.psat, h + 2*dh, phase, &flash2, fluids[f], "CoolProp", fluids[f]);
+					} catch (std::exception &e) {
+						cmp.fail(Q ? "setDewState" : "setBubbleState", p[i], phase, e.what());
+						continue;
+					}
+					double x2 = 10*Q + phase;
+					cmp.check("T", state.T, 2*flash1.T - flash2.T, 1e-6, p[i], x2);
+					cmp.check("d", state.d, 2*flash1.d - flash2.d, 1e-5, p[i], x2);
+					cmp.check("h", state.h, 2*flash1.h - flash2.h, 1e-6, p[i], x2);
+					cmp.check("s", state.s, 2*flash1.s - flash2.s, 1e-5, p[i], x2);
+					cmp.check("ddhp", state.ddhp, 2*flash1.ddhp - flash2.ddhp, 1e-4, p[i], x2);
+					cmp.check("ddph", state.ddph, 2*flash1.ddph - flash2.ddph, 1e-4, p[i], x2);
+					if (phase == 1) {
+						cmp.check("cp", state.cp, 2*flash1.cp - flash2.cp, 1e-4, p[i], x2);
+						cmp.check("kappa", state.kappa, 2*flash1.kappa - flash2.kappa, 1e-4, p[i], x2);
+						cmp.check("beta", state.beta, 2*flash1.beta - flash2.beta, 1e-4, p[i], x2);
+					}
+				}
+			}
+		}
+	}
+	return cmp.report();
+}
+
+/*! p-h and p-s flashes near the critical pressure within the flash budget against the generic flashes */
+static bool budgetCase(){
+	Comparison cmp("budget");
+	const char *fluids[] = {"CO2", "Water"};
+	for (int f = 0; f < 2; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		double pc = ref->p_critical(), Tc = ref->T_critical();
+		string substance = string(fluids[f]) + "|flash_max_iter=50";
+		// Subcooled, two-phase, superheated and supercritical states between 0.75 and 1.4 pc
+		for (int i = 0; i < 8; i++) {
+			double p = pc*(0.75 + 0.65*i/7);
+			for (int j = 0; j < 12; j++) {
+				ref->update(CoolProp::PT_INPUTS, p, Tc*(0.85 + 0.4*j/11));
+				double h = ref->hmass(), s = ref->smass();
+				for (int input = 0; input < 3; input++) {
+					// The third input is a two-phase state below the critical pressure
+					if (input == 2) {
+						if (p >= 0.98*pc)
+							continue;
+						ref->update(CoolProp::PQ_INPUTS, p, j/11.0);
+						h = ref->hmass();
+					}
+					ExternalThermodynamicState state;
+					try {
+						if (input == 1)
+							TwoPhaseMedium_setState_ps_C_impl(p, s, 0, &state, fluids[f], "CoolProp", substance.c_str());
+						else
+							TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, fluids[f], "CoolProp", substance.c_str());
+					} catch (std::exception &e) {
+						cmp.fail(input == 1 ? "setState_ps" : "setState_ph", p, input == 1 ? s : h, e.what());
+						continue;
+					}
+					if (input == 1)
+						ref->update(CoolProp::PSmass_INPUTS, p, s);
+					else
+						ref->update(CoolProp::HmassP_INPUTS, h, p);
+					cmp.check("T", state.T, ref->T(), 1e-8, p, input == 1 ? s : h);
+					cmp.check("d", state.d, ref->rhomass(), 1e-8, p, input == 1 ? s : h);
+				}
+			}
+		}
+	}
+
+	// Pseudo-critical CO2 liquid, solved by the generic flash within the budget
+	shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", "CO2"));
+	for (double h = 305e3; h <= 325e3; h += 2e3) {
+		ExternalThermodynamicState state;
+		try {
+			TwoPhaseMedium_setState_ph_C_impl(8e6, h, 0, &state, "CO2", "CoolProp", "CO2|flash_max_iter=50");
+		} catch (std::exception &e) {
+			cmp.fail("setState_ph", 8e6, h, e.what());
+			continue;
+		}
+		ref->update(CoolProp::HmassP_INPUTS, h, 8e6);
+		cmp.check("T", state.T, ref->T(), 1e-8, 8e6, h);
+		cmp.check("d", state.d, ref->rhomass(), 1e-8, 8e6, h);
+	}
+
+	// With a time budget every generic flash exceeds, later calls in the cells of
+	// the earlier ones skip it, and with flash_fallback=approximate they are
+	// extrapolated from the converged neighbours
+	double p = 1.05*ref->p_critical(), Tc = ref->T_critical();
+	int approximated = 0;
+	for (int i = 0; i < 200; i++) {
+		ref->update(CoolProp::PT_INPUTS, p, Tc*(0.95 + 0.15*i/199));
+		double h = ref->hmass();
+		ExternalThermodynamicState state;
+		int warnings = _warnings;
+		try {
+			TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, "CO2", "CoolProp", "CO2|flash_max_iter=8|flash_max_time=1e-9|flash_fallback=approximate");
+		} catch (std::exception &e) {
+			cmp.fail("setState_ph", p, h, e.what());
+			continue;
+		}
+		if (_warnings > warnings) {
+			// The inputs are kept, the density is a first-order estimate
+			approximated++;
+			cmp.check("p", state.p, p, 1e-12, p, h);
+			cmp.check("h", state.h, h, 1e-12, p, h);
+			cmp.check("d", state.d, ref->rhomass(), 0.1, p, h);
+		} else {
+			cmp.check("T", state.T, ref->T(), 1e-8, p, h);
+			cmp.check("d", state.d, ref->rhomass(), 1e-8, p, h);
+		}
+	}
+	if (approximated == 0)
+		cmp.fail("flash_fallback=approximate", p, 0, "no state was approximated");
+	return cmp.report();
+}
+
+/*! Interpolated two-phase properties from the cached saturated end points against evaluating them for every state */
+static bool twoPhaseCacheCase(){
+	Comparison cmp("twophase_cache");
+	const char *fluids[] = {"Water", "R134a"};
+	const int nP = 8, nQ = 5;
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	long lookups = 0;
+	for (int f = 0; f < 2; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		string uncached = string(fluids[f]) + "|twophase_endpoint_cache=0";
+		// The pressures fit into the cache, the second pass only has hits
+		std::vector<double> p = pressureGrid(ref->p_triple()*1.1, ref->p_critical()*0.9, nP);
+		for (int pass = 0; pass < 2; pass++) {
+			for (int i = 0; i < nP; i++) {
+				for (int j = 0; j < nQ; j++) {
+					ref->update(CoolProp::PQ_INPUTS, p[i], (j + 0.5)/nQ);
+					double h = ref->hmass();
+					ExternalThermodynamicState state, plain;
+					try {
+						TwoPhaseMedium_setState_ph_C_impl(p[i], h, 0, &state, fluids[f], "CoolProp", fluids[f]);
+						TwoPhaseMedium_setState_ph_C_impl(p[i], h, 0, &plain, fluids[f], "CoolProp", uncached.c_str());
+					} catch (std::exception &e) {
+						cmp.fail("setState_ph", p[i], h, e.what());
+						continue;
+					}
+					lookups++;
+					cmp.check("cv", state.cv, plain.cv, 1e-12, p[i], h);
+					cmp.check("a", state.a, plain.a, 1e-12, p[i], h);
+					cmp.check("cp", state.cp, plain.cp, 1e-12, p[i], h);
+					cmp.check("eta", state.eta, plain.eta, 1e-12, p[i], h);
+					cmp.check("lambda", state.lambda, plain.lambda, 1e-12, p[i], h);
+				}
+			}
+		}
+	}
+	// One miss per fluid and pressure, the uncached solvers do not look up
+	long misses = 2*nP;
+	if (eventCount("twoPhaseCacheMiss") != misses)
+		cmp.fail("twoPhaseCacheMiss", misses, eventCount("twoPhaseCacheMiss"), "unexpected number of misses");
+	if (eventCount("twoPhaseCacheHit") != lookups - misses)
+		cmp.fail("twoPhaseCacheHit", lookups - misses, eventCount("twoPhaseCacheHit"), "unexpected number of hits");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Approximate p-h cache: first-order extrapolation of cached states against HmassP updates */
+static bool taylorCase(){
+	Comparison cmp("taylor");
+	const char *fluids[] = {"Water", "R134a", "CO2"};
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	int probes = 0;
+	for (int f = 0; f < 3; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		string substance = string(fluids[f]) + "|taylor_cache_rtol=1e-5";
+		std::vector<std::pair<double, double> > states = singlePhaseGrid(ref, 8, 8);
+		for (size_t i = 0; i < states.size(); i++) {
+			double p = states[i].first;
+			ref->update(CoolProp::PT_INPUTS, p, states[i].second);
+			double h = ref->hmass();
+			// The state is computed and cached, the perturbed one is extrapolated
+			// from it as by a finite-difference Jacobian
+			double p1 = p*(1 + 5e-6), h1 = h*(1 - 5e-6);
+			ExternalThermodynamicState state;
+			try {
+				TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, fluids[f], "CoolProp", substance.c_str());
+				TwoPhaseMedium_setState_ph_C_impl(p1, h1, 0, &state, fluids[f], "CoolProp", substance.c_str());
+			} catch (std::exception &e) {
+				cmp.fail("setState_ph", p1, h1, e.what());
+				continue;
+			}
+			probes++;
+			ref->update(CoolProp::HmassP_INPUTS, h1, p1);
+			cmp.check("T", state.T, ref->T(), 1e-8, p1, h1);
+			cmp.check("d", state.d, ref->rhomass(), 1e-7, p1, h1);
+			cmp.check("s", state.s, ref->smass(), 1e-8, p1, h1);
+		}
+	}
+	// Incompressible brine, all states are cached
+	shared_ptr<CoolProp::AbstractState> brine(CoolProp::AbstractState::factory("INCOMP", "MEG"));
+	brine->set_mass_fractions(std::vector<double>(1, 0.3));
+	long brineHits = eventCount("taylorHit");
+	int brineProbes = 0;
+	for (int i = 0; i < 3; i++) {
+		double p = 1e5*pow(10.0, i/2.0);
+		for (int j = 0; j < 10; j++) {
+			brine->update(CoolProp::PT_INPUTS, p, 260 + 10*j);
+			double h = brine->hmass(), p1 = p*(1 + 5e-6), h1 = h*(1 - 5e-6);
+			ExternalThermodynamicState state;
+			try {
+				TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, "MEG30", "CoolProp", "INCOMP::MEG-30%|taylor_cache_rtol=1e-5");
+				TwoPhaseMedium_setState_ph_C_impl(p1, h1, 0, &state, "MEG30", "CoolProp", "INCOMP::MEG-30%|taylor_cache_rtol=1e-5");
+			} catch (std::exception &e) {
+				cmp.fail("setState_ph", p1, h1, e.what());
+				continue;
+			}
+			brineProbes++;
+			brine->update(CoolProp::HmassP_INPUTS, h1, p1);
+			cmp.check("T", state.T, brine->T(), 1e-8, p1, h1);
+			cmp.check("d", state.d, brine->rhomass(), 1e-8, p1, h1);
+			cmp.check("s", state.s, brine->smass(), 1e-7, p1, h1);
+		}
+	}
+	if (eventCount("taylorHit") - brineHits != brineProbes)
+		cmp.fail("taylorHit", brineProbes, eventCount("taylorHit") - brineHits, "incompressible states were not reused");
+	// States near the saturation lines and the critical point are not cached,
+	// most of the others have to be hits
+	if (eventCount("taylorHit") - brineProbes < probes/2)
+		cmp.fail("taylorHit", probes, eventCount("taylorHit") - brineProbes, "too few cache hits");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Warm-started p-s and h-s flashes from the nearest indexed state against the generic flashes */
+static bool warmStartCase(){
+	Comparison cmp("warmstart");
+	const char *fluids[] = {"Water", "R134a", "CO2"};
+	for (int f = 0; f < 3; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		string substance = string(fluids[f]) + "|warmstart_index=4096";
+		// The second pass starts from the states of the first one, shifted by 0.2%
+		std::vector<std::pair<double, double> > states = singlePhaseGrid(ref, 10, 10);
+		for (int pass = 0; pass < 2; pass++) {
+			for (size_t i = 0; i < states.size(); i++) {
+				double p = states[i].first, T = states[i].second*(1 + 0.002*pass);
+				ref->update(CoolProp::PT_INPUTS, p, T);
+				double h = ref->hmass(), s = ref->smass();
+				for (int input = 0; input < 2; input++) {
+					ExternalThermodynamicState state;
+					try {
+						if (input == 0)
+							TwoPhaseMedium_setState_ps_C_impl(p, s, 0, &state, fluids[f], "CoolProp", substance.c_str());
+						else
+							TwoPhaseMedium_setState_hs_C_impl(h, s, 0, &state, fluids[f], "CoolProp", substance.c_str());
+					} catch (std::exception &e) {
+						cmp.fail(input ? "setState_hs" : "setState_ps", input ? h : p, s, e.what());
+						continue;
+					}
+					if (input == 0)
+						ref->update(CoolProp::PSmass_INPUTS, p, s);
+					else
+						ref->update(CoolProp::HmassSmass_INPUTS, h, s);
+					cmp.check("T", state.T, ref->T(), 1e-8, input ? h : p, s);
+					cmp.check("d", state.d, ref->rhomass(), 1e-8, input ? h : p, s);
+					// The pressure of a liquid is ill-conditioned in h and s
+					cmp.check("p", state.p, ref->p(), input ? 1e-6 : 1e-8, input ? h : p, s);
+					// Restore the state of the inputs for the next input pair
+					ref->update(CoolProp::PT_INPUTS, p, T);
+				}
+			}
+		}
+	}
+	return cmp.report();
+}
+
+/*! Failed p-h and p-s flashes called twice: the second call reports the stored error without a flash */
+static bool failureCacheCase(){
+	Comparison cmp("failure_cache");
+	// Enthalpies, then entropies below and above the range of the equation of state
+	const double p = 1e6, x[] = {-1e7, 1e9, -1e5, 1e7};
+	const int n = sizeof(x)/sizeof(x[0]);
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	for (int i = 0; i < n; i++) {
+		bool ps = i >= n/2;
+		const char *what = ps ? "setState_ps" : "setState_ph";
+		string message[2];
+		for (int call = 0; call < 2; call++) {
+			ExternalThermodynamicState state;
+			try {
+				if (ps)
+					TwoPhaseMedium_setState_ps_C_impl(p, x[i], 0, &state, "Water", "CoolProp", "Water|failure_cache=8");
+				else
+					TwoPhaseMedium_setState_ph_C_impl(p, x[i], 0, &state, "Water", "CoolProp", "Water|failure_cache=8");
+				cmp.fail(what, p, x[i], "did not fail");
+			} catch (FastPathError &e) {
+				message[call] = e.what();
+			}
+		}
+		if (message[0].empty() || message[1] != message[0])
+			cmp.fail(what, p, x[i], ("the cached error differs: " + message[1]).c_str());
+		else
+			cmp.check(what, 0, 0, 0, p, x[i]);
+		// Valid inputs of the same solver are not affected
+		ExternalThermodynamicState state;
+		try {
+			TwoPhaseMedium_setState_ph_C_impl(p, 1e5*(i + 1), 0, &state, "Water", "CoolProp", "Water|failure_cache=8");
+		} catch (std::exception &e) {
+			cmp.fail("setState_ph", p, 1e5*(i + 1), e.what());
+		}
+	}
+	// One stored failure and one hit per input
+	if (eventCount("failureCacheStore") != n)
+		cmp.fail("failureCacheStore", n, eventCount("failureCacheStore"), "unexpected number of stored failures");
+	if (eventCount("failureCacheHit") != n)
+		cmp.fail("failureCacheHit", n, eventCount("failureCacheHit"), "unexpected number of hits");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Compare all values of a state with a reference state */
+static void checkSameState(Comparison &cmp, const ExternalThermodynamicState &state, const ExternalThermodynamicState &ref, double rtol, double x1, double x2){
+	cmp.check("T", state.T, ref.T, rtol, x1, x2);
+	cmp.check("a", state.a, ref.a, rtol, x1, x2);
+	cmp.check("beta", state.beta, ref.beta, rtol, x1, x2);
+	cmp.check("cp", state.cp, ref.cp, rtol, x1, x2);
+	cmp.check("cv", state.cv, ref.cv, rtol, x1, x2);
+	cmp.check("d", state.d, ref.d, rtol, x1, x2);
+	cmp.check("ddhp", state.ddhp, ref.ddhp, rtol, x1, x2);
+	cmp.check("ddph", state.ddph, ref.ddph, rtol, x1, x2);
+	cmp.check("eta", state.eta, ref.eta, rtol, x1, x2);
+	cmp.check("h", state.h, ref.h, rtol, x1, x2);
+	cmp.check("kappa", state.kappa, ref.kappa, rtol, x1, x2);
+	cmp.check("lambda", state.lambda, ref.lambda, rtol, x1, x2);
+	cmp.check("p", state.p, ref.p, rtol, x1, x2);
+	cmp.check("phase", state.phase, ref.phase, rtol, x1, x2);
+	cmp.check("s", state.s, ref.s, rtol, x1, x2);
+}
+
+/*! Run the p-T and p-h states of the memo store cases through two solvers */
+/*!
+  The first solver uses the memo store under the key of the plain fluid name,
+  the second one under another key. Returns the number of states.
+*/
+static int memoStates(Comparison &cmp, const char *second){
+	const char *fluids[] = {"Water", "R134a"};
+	int n = 0;
+	for (int f = 0; f < 2; f++) {
+		shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", fluids[f]));
+		string other = string(fluids[f]) + second;
+		std::vector<std::pair<double, double> > states = singlePhaseGrid(ref, 5, 5);
+		for (size_t i = 0; i < states.size(); i++) {
+			double p = states[i].first, T = states[i].second;
+			ref->update(CoolProp::PT_INPUTS, p, T);
+			double h = ref->hmass();
+			for (int input = 0; input < 2; input++) {
+				ExternalThermodynamicState state, computed;
+				try {
+					if (input == 0) {
+						TwoPhaseMedium_setState_pT_C_impl(p, T, &state, fluids[f], "CoolProp", fluids[f]);
+						TwoPhaseMedium_setState_pT_C_impl(p, T, &computed, fluids[f], "CoolProp", other.c_str());
+					} else {
+						TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, fluids[f], "CoolProp", fluids[f]);
+						TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &computed, fluids[f], "CoolProp", other.c_str());
+					}
+				} catch (std::exception &e) {
+					cmp.fail(input ? "setState_ph" : "setState_pT", p, input ? h : T, e.what());
+					continue;
+				}
+				// A stored state is returned bit for bit
+				checkSameState(cmp, state, computed, 0, p, input ? h : T);
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+/*! First run on a new memo store: the states are computed, stored and found again */
+/*!
+  Run with EXTERNALMEDIA_MEMO_STORE naming a file that does not exist yet,
+  the memo_reopen case then reopens it in another process. Both cases are
+  skipped without a memo store.
+*/
+static bool memoStoreCase(){
+	Comparison cmp("memo_store");
+	if (!getenv("EXTERNALMEDIA_MEMO_STORE") || !strlen(getenv("EXTERNALMEDIA_MEMO_STORE"))) {
+		printf("%-24s skipped, EXTERNALMEDIA_MEMO_STORE is not set\n", "memo_store");
+		return true;
+	}
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	// The second solver has the same key and finds the states of the first one
+	int n = memoStates(cmp, "");
+	if (eventCount("memoMiss") != n)
+		cmp.fail("memoMiss", n, eventCount("memoMiss"), "the memo store is not new");
+	if (eventCount("memoHit") != n)
+		cmp.fail("memoHit", n, eventCount("memoHit"), "stored states were not found");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Second run on the memo store of memo_store: the states are found in the file */
+static bool memoReopenCase(){
+	Comparison cmp("memo_reopen");
+	if (!getenv("EXTERNALMEDIA_MEMO_STORE") || !strlen(getenv("EXTERNALMEDIA_MEMO_STORE"))) {
+		printf("%-24s skipped, EXTERNALMEDIA_MEMO_STORE is not set\n", "memo_reopen");
+		return true;
+	}
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	// The second solver has another key, its states are computed again
+	int n = memoStates(cmp, "|calc_transport=1");
+	if (eventCount("memoHit") != n)
+		cmp.fail("memoHit", n, eventCount("memoHit"), "the states of the first run were not found");
+	if (eventCount("memoMiss") != n)
+		cmp.fail("memoMiss", n, eventCount("memoMiss"), "unexpected number of misses");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Input of the fallback case with its reference state */
+struct FallbackInput{
+	double p, x; /* pressure and specific enthalpy, or temperature for p-T inputs */
+	double T, d;
+};
+
+/*! Run inputs through the plain solver and through a fallback chain of one stage */
+/*!
+  The recovered states are compared with the reference, the states of the
+  plain flash must not be changed by the chain, and the hit and miss events
+  of the stage must match the failed and recovered flashes.
+  @return Number of states recovered by the stage
+*/
+static long fallbackStage(Comparison &cmp, const string &plain, const char *stage, bool pT, const std::vector<FallbackInput> &inputs, double rtol){
+	const char *stages[] = {"eos", "guesses", "phase"};
+	const char *hitEvents[] = {"fallbackEosHit", "fallbackGuessesHit", "fallbackPhaseHit"};
+	const char *missEvents[] = {"fallbackEosMiss", "fallbackGuessesMiss", "fallbackPhaseMiss"};
+	int s = 0;
+	while (strcmp(stages[s], stage))
+		s++;
+	string chained = plain + "|fallback_chain=" + stage;
+	string fluid = plain.substr(0, plain.find('|'));
+	long failed = 0, recovered = 0, hits = eventCount(hitEvents[s]), misses = eventCount(missEvents[s]);
+	for (size_t i = 0; i < inputs.size(); i++) {
+		const FallbackInput &x = inputs[i];
+		ExternalThermodynamicState plainState, state;
+		bool plainFailed = false;
+		try {
+			if (pT)
+				TwoPhaseMedium_setState_pT_C_impl(x.p, x.x, &plainState, fluid.c_str(), "CoolProp", plain.c_str());
+			else
+				TwoPhaseMedium_setState_ph_C_impl(x.p, x.x, 0, &plainState, fluid.c_str(), "CoolProp", plain.c_str());
+		} catch (std::exception &) {
+			plainFailed = true;
+			failed++;
+		}
+		try {
+			if (pT)
+				TwoPhaseMedium_setState_pT_C_impl(x.p, x.x, &state, fluid.c_str(), "CoolProp", chained.c_str());
+			else
+				TwoPhaseMedium_setState_ph_C_impl(x.p, x.x, 0, &state, fluid.c_str(), "CoolProp", chained.c_str());
+		} catch (std::exception &e) {
+			// A stage may not apply, but a successful flash must not be lost
+			if (!plainFailed)
+				cmp.fail(stage, x.p, x.x, e.what());
+			continue;
+		}
+		if (plainFailed) {
+			recovered++;
+			cmp.check("T", state.T, x.T, rtol, x.p, x.x);
+			cmp.check("d", state.d, x.d, rtol, x.p, x.x);
+		} else {
+			// States the plain flash computes are not changed by the chain
+			cmp.check("T", state.T, plainState.T, 1e-15, x.p, x.x);
+			cmp.check("d", state.d, plainState.d, 1e-15, x.p, x.x);
+		}
+	}
+	// Every failed flash tries the stage once
+	hits = eventCount(hitEvents[s]) - hits;
+	misses = eventCount(missEvents[s]) - misses;
+	printf("%-12s fallback_chain=%-8s %ld failed flashes, %ld recovered\n", fluid.c_str(), stage, failed, recovered);
+	if (hits != recovered || hits + misses != failed)
+		cmp.fail(hitEvents[s], hits, misses, "the counted hits and misses do not match the failed and recovered states");
+	return recovered;
+}
+
+/*! Fallback chain: states recovered after a failed flash, each by the stage meant for it */
+static bool fallbackCase(){
+	Comparison cmp("fallback");
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	std::vector<FallbackInput> inputs;
+	FallbackInput x;
+
+	// The p-h flashes of the bicubic tables fail in the cells of the liquid next
+	// to the bubble line at low pressure. The eos stage repeats them with HEOS.
+	shared_ptr<CoolProp::AbstractState> ref(CoolProp::AbstractState::factory("HEOS", "CO2"));
+	const double dT[] = {-3, -1, -0.3, -0.1, 0.1, 0.3, 1, 3};
+	std::vector<double> p = pressureGrid(ref->p_triple()*1.05, ref->p_critical()*0.98, 20);
+	for (size_t i = 0; i < p.size(); i++) {
+		ref->update(CoolProp::PQ_INPUTS, p[i], 0);
+		double Tsat = ref->T();
+		for (int j = 0; j < 8; j++) {
+			try {
+				ref->update(CoolProp::PT_INPUTS, p[i], Tsat + dT[j]);
+			} catch (std::exception &) {
+				// Below the melting line
+				continue;
+			}
+			x.p = p[i];
+			x.x = ref->hmass();
+			x.T = ref->T();
+			x.d = ref->rhomass();
+			inputs.push_back(x);
+		}
+	}
+	long eos = fallbackStage(cmp, "CO2|enable_BICUBIC=1", "eos", false, inputs, 1e-8);
+
+	// The p-h flashes of HEOS fail for the R134a liquid between 0.9967 and
+	// 0.9992 pc. The guesses stage recovers them with Newton steps from the
+	// state at the next lower pressure, imposing the liquid phase does not help.
+	ref.reset(CoolProp::AbstractState::factory("HEOS", "R134a"));
+	inputs.clear();
+	for (int i = 0; i < 50; i++) {
+		x.p = ref->p_critical()*(0.995 + 1e-4*i);
+		ref->update(CoolProp::PQ_INPUTS, x.p, 0);
+		ref->update(CoolProp::PT_INPUTS, x.p, ref->T() - 1);
+		x.x = ref->hmass();
+		x.T = ref->T();
+		x.d = ref->rhomass();
+		inputs.push_back(x);
+	}
+	long guesses = fallbackStage(cmp, "R134a", "guesses", false, inputs, 1e-6);
+	long phaseLiquid = fallbackStage(cmp, "R134a", "phase", false, inputs, 1e-6);
+
+	// HEOS rejects the p-T inputs of vapour within 1e-6 of the saturation
+	// pressure. The phase stage recovers them with the gas phase of the state
+	// before, which is 5 K further from the dew line.
+	ref.reset(CoolProp::AbstractState::factory("HEOS", "Water"));
+	inputs.clear();
+	p = pressureGrid(ref->p_triple()*1.05, ref->p_critical()*0.98, 20);
+	for (size_t i = 0; i < p.size(); i++) {
+		ref->update(CoolProp::PQ_INPUTS, p[i], 1);
+		double Tsat = ref->T();
+		x.p = p[i];
+		x.x = Tsat + 5;
+		ref->update(CoolProp::PT_INPUTS, x.p, x.x);
+		x.T = ref->T();
+		x.d = ref->rhomass();
+		inputs.push_back(x);
+		x.x = Tsat*(1 + 1e-8);
+		ref->specify_phase(CoolProp::iphase_gas);
+		ref->update(CoolProp::PT_INPUTS, x.p, x.x);
+		ref->unspecify_phase();
+		x.T = ref->T();
+		x.d = ref->rhomass();
+		inputs.push_back(x);
+	}
+	long phase = fallbackStage(cmp, "Water", "phase", true, inputs, 1e-8);
+
+	if (eos == 0)
+		cmp.fail("eos", 0, 0, "no state recovered");
+	if (guesses == 0 || phaseLiquid != 0)
+		cmp.fail("guesses", guesses, phaseLiquid, "the near-critical liquid is not recovered by the guesses stage alone");
+	if (phase == 0)
+		cmp.fail("phase", 0, 0, "no state recovered");
+	TwoPhaseMedium_enableStatistics(0);
+	return cmp.report();
+}
+
+/*! Test cases by name */
+struct TestCase{
+	const char *name;
+	bool (*run)();
+};
+
+static const TestCase _cases[] = {
+	{"spline", splineCase},
+	{"dx", dxCase},
+	{"shared_vle", sharedVLECase},
+	{"bubble_dew", bubbleDewCase},
+	{"twophase_cache", twoPhaseCacheCase},
+	{"taylor", taylorCase},
+	{"warmstart", warmStartCase},
+	{"budget", budgetCase},
+	{"failure_cache", failureCacheCase},
+	{"fallback", fallbackCase},
+	{"memo_store", memoStoreCase},
+	{"memo_reopen", memoReopenCase},
+};
+
+int main(int argc, char *argv[]){
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(_cases)/sizeof(_cases[0]); i++) {
+		bool selected = argc < 2;
+		for (int j = 1; j < argc; j++)
+			selected = selected || !strcmp(argv[j], _cases[i].name);
+		if (!selected)
+			continue;
+		try {
+			if (!_cases[i].run())
+				failed++;
+		} catch (std::exception &e) {
+			printf("%-24s FAILED: %s\n", _cases[i].name, e.what());
+			failed++;
+		}
+	}
+	return failed;
+}
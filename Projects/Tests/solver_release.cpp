@@ -0,0 +1,122 @@
+/*
+  solver_release
+
+  Releases solvers with TwoPhaseMedium_releaseSolver and
+  TwoPhaseMedium_releaseAll and checks that the next call creates them again.
+  The calls use the TestMedium solver under two substance names, so that
+  releasing one solver must leave the other one in place. The creations are
+  counted in the call statistics as createSolver calls.
+
+  Usage: solver_release
+    The exit code is 1 if a check fails.
+
+  The library is compiled into the test, ModelicaError is implemented by
+  throwing an exception.
+*/
+
+#include "externalmedialib.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define RELEASE_EXPORT __declspec(dllexport)
+#else
+#define RELEASE_EXPORT
+#endif
+
+using std::string;
+
+/*! Error reported by the library through ModelicaError */
+class ReleaseError : public std::runtime_error{
+public:
+	ReleaseError(const char *message) : std::runtime_error(message){}
+};
+
+extern "C" {
+	RELEASE_EXPORT void ModelicaError(const char *string){
+		throw ReleaseError(string);
+	}
+	RELEASE_EXPORT void ModelicaWarning(const char *string){
+	}
+}
+
+static const char *_library = "TestMedium";
+static const char *_substances[] = {"TestMedium", "TestMedium2"};
+
+static int _failed = 0;
+
+/*! Report a failed check */
+static void expect(bool condition, const char *what){
+	if (!condition) {
+		printf("solver_release: %s\n", what);
+		_failed++;
+	}
+}
+
+/*! Sum of the createSolver calls over all solvers in the call statistics */
+static long solverCreations(){
+	std::vector<char> buffer(TwoPhaseMedium_getStatistics(NULL, 0) + 1);
+	TwoPhaseMedium_getStatistics(&buffer[0], (int)buffer.size());
+	const char *key = "\"createSolver\": {\"calls\": ";
+	long count = 0;
+	for (const char *match = strstr(&buffer[0], key); match; match = strstr(match + 1, key))
+		count += atol(match + strlen(key));
+	return count;
+}
+
+/*! Compute a state with the solver of a substance, creating it if needed */
+static ExternalThermodynamicState computeState(int substance){
+	ExternalThermodynamicState state;
+	TwoPhaseMedium_setState_ph_C_impl(2e5, 1e6, 0, &state, _library, _library, _substances[substance]);
+	return state;
+}
+
+/*! Bytes held by the solver of a substance, 0 if it does not exist */
+static double memoryUsage(int substance){
+	return TwoPhaseMedium_memoryUsage(_library, _library, _substances[substance]);
+}
+
+int main(int argc, char *argv[]){
+	TwoPhaseMedium_enableStatistics(1);
+	TwoPhaseMedium_resetStatistics();
+	try {
+		expect(memoryUsage(0) == 0 && memoryUsage(1) == 0, "a solver exists before the first call");
+		ExternalThermodynamicState first = computeState(0);
+		computeState(1);
+		expect(solverCreations() == 2, "the first calls did not create two solvers");
+		double usage = memoryUsage(0);
+		expect(usage > 0 && memoryUsage(1) > 0, "the solvers report no memory");
+
+		// Release one solver, the other one stays
+		expect(TwoPhaseMedium_releaseSolver(_library, _library, _substances[0]) == usage, "releaseSolver did not report the memory of the solver");
+		expect(memoryUsage(0) == 0, "the released solver still exists");
+		expect(memoryUsage(1) > 0, "releaseSolver released another solver");
+		expect(TwoPhaseMedium_releaseSolver(_library, _library, _substances[0]) == 0, "a solver was released twice");
+
+		// The next call creates the released solver again, with the same results
+		ExternalThermodynamicState again = computeState(0);
+		computeState(1);
+		expect(solverCreations() == 3, "the released solver was not created again by the next call");
+		expect(again.T == first.T && again.d == first.d && again.s == first.s, "the solver created again gives other results");
+		expect(memoryUsage(0) > 0, "the solver created again reports no memory");
+
+		// Release all solvers and create both again
+		usage = memoryUsage(0) + memoryUsage(1);
+		expect(TwoPhaseMedium_releaseAll() == usage, "releaseAll did not report the memory of the solvers");
+		expect(memoryUsage(0) == 0 && memoryUsage(1) == 0, "releaseAll did not release all solvers");
+		computeState(0);
+		computeState(1);
+		expect(solverCreations() == 5, "the solvers were not created again after releaseAll");
+	} catch (std::exception &e) {
+		printf("solver_release: call failed: %s\n", e.what());
+		_failed++;
+	}
+	TwoPhaseMedium_enableStatistics(0);
+	if (!_failed)
+		printf("solver_release: passed\n");
+	return _failed ? 1 : 0;
+}
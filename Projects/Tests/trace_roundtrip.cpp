@@ -0,0 +1,83 @@
+/*
+  trace_roundtrip
+
+  Records a call trace for the trace_replay test. Run with EXTERNALMEDIA_TRACE
+  set to the trace file, the trace is complete when the process ends. The
+  calls use the TestMedium solver, and some of them fail: ModelicaError throws
+  an exception, so the failed calls unwind through the call recorder and must
+  not be part of the trace. externalmedia_replay --tolerance 0 then replays
+  the trace and fails if a recorded call fails or gives other outputs.
+
+  Usage: trace_roundtrip
+    The exit code is 1 if a call that should fail does not fail, or the
+    other way round.
+
+  The library is compiled into the test, ModelicaError is implemented by
+  throwing an exception.
+*/
+
+#include "externalmedialib.h"
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef WIN32
+#define ROUNDTRIP_EXPORT __declspec(dllexport)
+#else
+#define ROUNDTRIP_EXPORT
+#endif
+
+/*! Error reported by the library through ModelicaError */
+class RoundtripError : public std::runtime_error{
+public:
+	RoundtripError(const char *message) : std::runtime_error(message){}
+};
+
+extern "C" {
+	ROUNDTRIP_EXPORT void ModelicaError(const char *string){
+		throw RoundtripError(string);
+	}
+	ROUNDTRIP_EXPORT void ModelicaWarning(const char *string){
+	}
+}
+
+static const char *_medium = "TestMedium";
+
+int main(int argc, char *argv[]){
+	if (!getenv("EXTERNALMEDIA_TRACE"))
+		printf("trace_roundtrip: EXTERNALMEDIA_TRACE is not set, the calls are not recorded\n");
+	int failed = 0, recorded = 0;
+	ExternalThermodynamicState state;
+	ExternalSaturationProperties sat;
+	for (int i = 0; i < 5; i++) {
+		double p = 1e5*(1 + i), h = 1e5*(1 + 0.5*i), T = 300 + 10*i;
+		try {
+			TwoPhaseMedium_setState_ph_C_impl(p, h, 0, &state, _medium, _medium, _medium);
+			TwoPhaseMedium_setState_pT_C_impl(p, T, &state, _medium, _medium, _medium);
+			TwoPhaseMedium_setState_dT_C_impl(state.d, T, 0, &state, _medium, _medium, _medium);
+			TwoPhaseMedium_setState_ps_C_impl(p, state.s, 0, &state, _medium, _medium, _medium);
+			TwoPhaseMedium_setSat_p_C_impl(p, &sat, _medium, _medium, _medium);
+			TwoPhaseMedium_setSat_T_C_impl(T, &sat, _medium, _medium, _medium);
+			TwoPhaseMedium_saturationTemperature_C_impl(p, _medium, _medium, _medium);
+			recorded += 7;
+		} catch (std::exception &e) {
+			printf("trace_roundtrip: call failed: %s\n", e.what());
+			failed++;
+		}
+		// Not implemented by TestMedium, the calls throw from inside the recorder
+		try {
+			TwoPhaseMedium_setState_hs_C_impl(h, 1e3, 0, &state, _medium, _medium, _medium);
+			printf("trace_roundtrip: setState_hs did not fail\n");
+			failed++;
+		} catch (RoundtripError &) {
+		}
+		try {
+			TwoPhaseMedium_temperature_C_impl(&state, _medium, _medium, _medium);
+			printf("trace_roundtrip: temperature did not fail\n");
+			failed++;
+		} catch (RoundtripError &) {
+		}
+	}
+	printf("trace_roundtrip: %d calls recorded\n", recorded);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,464 @@
+/*
+  externalmedia_backends
+
+  Compares the CoolProp backends and solver options for one substance: the
+  same sampled workload is run through each candidate, and the time per call,
+  the maximum and mean relative errors per property with respect to a
+  reference candidate, the setup time and the memory footprint are reported.
+  The candidates that are not both slower and less accurate than another one
+  are marked as Pareto optimal.
+
+  Usage: externalmedia_backends [options] substance
+    --candidate S  substance string of a candidate, e.g. "HEOS::R134a|enable_TTSE=1",
+                   can be repeated and replaces the default candidates
+    --reference S  substance string of the reference, default HEOS::substance
+    --min-time T   minimum time per workload and candidate in seconds, default 0.2
+    --json FILE    also write the report to a JSON file
+
+  The default candidates are HEOS, HEOS with enable_TTSE and enable_BICUBIC,
+  HEOS with the ExternalMedia two-phase spline table and, for Water, IF97.
+  An incompressible substance (INCOMP::...) is only compared with itself.
+
+  The workload is a grid of pressure and specific enthalpy points in the
+  liquid, two-phase, vapour and supercritical regions, computed with the
+  reference, and the saturation properties at the grid pressures. Points the
+  reference cannot compute are dropped, points a candidate cannot compute are
+  counted as failures. The memory footprint is the growth of the resident set
+  size during the setup of the candidate, it is only available on Linux, and
+  is shown next to the estimate of TwoPhaseMedium_memoryUsage.
+
+  The library is compiled into the tool, ModelicaError is implemented by
+  throwing an exception.
+*/
+
+#include "externalmedialib.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#ifdef WIN32
+#define BACKENDS_EXPORT __declspec(dllexport)
+#else
+#define BACKENDS_EXPORT
+#endif
+
+using std::string;
+
+/*! Error reported by the library through ModelicaError */
+class BackendError : public std::runtime_error{
+public:
+	BackendError(const char *message) : std::runtime_error(message){}
+};
+
+extern "C" {
+	BACKENDS_EXPORT void ModelicaError(const char *string){
+		throw BackendError(string);
+	}
+	BACKENDS_EXPORT void ModelicaWarning(const char *string){
+	}
+}
+
+/*! Compared properties, the first ones are from setState_ph, the others from setSat_p */
+enum Property { T, d, s, cp, a, eta, lambda, Tsat, dl, dv, hl, hv, nProperties };
+static const int nStateProperties = Tsat;
+
+static const char *_propertyNames[nProperties] = {
+	"T", "d", "s", "cp", "a", "eta", "lambda", "Tsat", "dl", "dv", "hl", "hv"
+};
+
+static void stateProperties(const ExternalThermodynamicState &state, double *values){
+	values[T] = state.T;
+	values[d] = state.d;
+	values[s] = state.s;
+	values[cp] = state.cp;
+	values[a] = state.a;
+	values[eta] = state.eta;
+	values[lambda] = state.lambda;
+}
+
+static void satProperties(const ExternalSaturationProperties &sat, double *values){
+	values[Tsat] = sat.Tsat;
+	values[dl] = sat.dl;
+	values[dv] = sat.dv;
+	values[hl] = sat.hl;
+	values[hv] = sat.hv;
+}
+
+/*! Sampled workload with the reference values */
+struct Workload{
+	std::vector<double> p, h;        /* setState_ph inputs */
+	std::vector<double> psat;        /* setSat_p inputs */
+	std::vector<double> stateValues; /* nStateProperties reference values per state point */
+	std::vector<double> satValues;   /* nProperties reference values per saturation point, from index Tsat */
+};
+
+/*! Report of one candidate */
+struct CandidateReport{
+	string substance;
+	string error;
+	double setupTime, memory, memoryEstimate;
+	double phTime, satTime;
+	long failures;
+	double maxError[nProperties], meanError[nProperties];
+	bool pareto;
+};
+
+//! Resident set size of the process in bytes, NaN if unknown
+static double residentMemory(){
+#if defined(__linux__)
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return NAN;
+	long pages = 0, resident = 0;
+	int n = fscanf(file, "%ld %ld", &pages, &resident);
+	fclose(file);
+	return n == 2 ? (double)resident*sysconf(_SC_PAGESIZE) : NAN;
+#else
+	return NAN;
+#endif
+}
+
+#define SOLVER "ExternalMedia.Backends", "CoolProp", substance
+
+//! Sample the workload with the reference
+static void sampleWorkload(const char *substance, Workload &workload){
+	double pc = TwoPhaseMedium_getCriticalPressure_C_impl(SOLVER);
+	double Tc = TwoPhaseMedium_getCriticalTemperature_C_impl(SOLVER);
+	bool compressible = std::isfinite(pc) && pc > 0 && std::isfinite(Tc) && Tc > 0;
+	const int nP = 12, nT = 10;
+	double values[nProperties];
+	ExternalThermodynamicState state;
+	ExternalSaturationProperties sat;
+	for (int i = 0; i < nP; i++){
+		// Logarithmic pressures from 1 % to 200 % of the critical pressure, 1 to 50 bar for liquids
+		double p = compressible ? 0.01*pc*pow(200.0, i/(nP - 1.0)) : 1e5*pow(50.0, i/(nP - 1.0));
+		std::vector<double> h;
+		for (int j = 0; j < nT; j++){
+			double Tj = compressible ? Tc*(0.5 + j/(nT - 1.0)) : 260 + 80*j/(nT - 1.0);
+			try {
+				TwoPhaseMedium_setState_pT_C_impl(p, Tj, &state, SOLVER);
+				h.push_back(state.h);
+			} catch (BackendError &){
+			}
+		}
+		if (compressible && p < pc){
+			try {
+				TwoPhaseMedium_setSat_p_C_impl(p, &sat, SOLVER);
+				satProperties(sat, values);
+				workload.psat.push_back(p);
+				workload.satValues.insert(workload.satValues.end(), values + Tsat, values + nProperties);
+				for (int k = 1; k < 4; k++)
+					h.push_back(sat.hl + 0.25*k*(sat.hv - sat.hl));
+			} catch (BackendError &){
+			}
+		}
+		for (size_t j = 0; j < h.size(); j++){
+			try {
+				TwoPhaseMedium_setState_ph_C_impl(p, h[j], 0, &state, SOLVER);
+				stateProperties(state, values);
+				workload.p.push_back(p);
+				workload.h.push_back(h[j]);
+				workload.stateValues.insert(workload.stateValues.end(), values, values + nStateProperties);
+			} catch (BackendError &){
+			}
+		}
+	}
+}
+
+//! Add the relative error of a value
+static void addError(double value, double reference, double &maxError, double &sumError, long &count){
+	if (!std::isfinite(reference))
+		return;
+	double error = fabs(value - reference);
+	if (reference != 0)
+		error /= fabs(reference);
+	if (std::isnan(error))
+		error = INFINITY;
+	maxError = std::max(maxError, error);
+	sumError += error;
+	count++;
+}
+
+//! Run the workload with a candidate
+static CandidateReport runCandidate(const string &candidate, const Workload &workload, double minTime){
+	const char *substance = candidate.c_str();
+	CandidateReport report;
+	report.substance = candidate;
+	report.setupTime = report.memory = report.memoryEstimate = report.phTime = report.satTime = NAN;
+	report.failures = 0;
+	report.pareto = false;
+	for (int i = 0; i < nProperties; i++)
+		report.maxError[i] = report.meanError[i] = NAN;
+
+	// Setup: solver construction and the first pass, which builds the tables
+	double memory = residentMemory();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ExternalThermodynamicState state;
+	ExternalSaturationProperties sat;
+	try {
+		TwoPhaseMedium_getMolarMass_C_impl(SOLVER);
+	} catch (BackendError &e){
+		report.error = e.what();
+		return report;
+	}
+	double maxError[nProperties], sumError[nProperties];
+	long count[nProperties];
+	for (int i = 0; i < nProperties; i++){
+		maxError[i] = sumError[i] = 0;
+		count[i] = 0;
+	}
+	double values[nProperties];
+	std::vector<bool> phFailed(workload.p.size(), false), satFailed(workload.psat.size(), false);
+	for (size_t i = 0; i < workload.p.size(); i++){
+		try {
+			TwoPhaseMedium_setState_ph_C_impl(workload.p[i], workload.h[i], 0, &state, SOLVER);
+			stateProperties(state, values);
+			for (int j = 0; j < nStateProperties; j++)
+				addError(values[j], workload.stateValues[i*nStateProperties + j], maxError[j], sumError[j], count[j]);
+		} catch (BackendError &){
+			phFailed[i] = true;
+			report.failures++;
+		}
+	}
+	for (size_t i = 0; i < workload.psat.size(); i++){
+		try {
+			TwoPhaseMedium_setSat_p_C_impl(workload.psat[i], &sat, SOLVER);
+			satProperties(sat, values);
+			for (int j = Tsat; j < nProperties; j++)
+				addError(values[j], workload.satValues[i*(nProperties - Tsat) + j - Tsat], maxError[j], sumError[j], count[j]);
+		} catch (BackendError &){
+			satFailed[i] = true;
+			report.failures++;
+		}
+	}
+	report.setupTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report.memory = residentMemory() - memory;
+	report.memoryEstimate = TwoPhaseMedium_memoryUsage(SOLVER);
+	for (int i = 0; i < nProperties; i++){
+		if (count[i] > 0){
+			report.maxError[i] = maxError[i];
+			report.meanError[i] = sumError[i]/count[i];
+		}
+	}
+
+	// Timing of the points that did not fail
+	for (int w = 0; w < 2; w++){
+		const std::vector<bool> &failed = w == 0 ? phFailed : satFailed;
+		long calls = 0;
+		double elapsed = 0;
+		start = std::chrono::steady_clock::now();
+		try {
+			do {
+				for (size_t i = 0; i < failed.size(); i++){
+					if (failed[i])
+						continue;
+					if (w == 0)
+						TwoPhaseMedium_setState_ph_C_impl(workload.p[i], workload.h[i], 0, &state, SOLVER);
+					else
+						TwoPhaseMedium_setSat_p_C_impl(workload.psat[i], &sat, SOLVER);
+					calls++;
+				}
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			} while (calls > 0 && elapsed < minTime);
+		} catch (BackendError &){
+			// Results that are not reproducible are not timed
+			calls = 0;
+		}
+		(w == 0 ? report.phTime : report.satTime) = calls > 0 ? elapsed*1e9/calls : NAN;
+	}
+	return report;
+}
+
+//! Largest error over the properties of a candidate, failures count as infinite
+static double worstError(const CandidateReport &report){
+	if (!report.error.empty() || report.failures > 0)
+		return INFINITY;
+	double worst = 0;
+	for (int i = 0; i < nProperties; i++)
+		if (!std::isnan(report.maxError[i]))
+			worst = std::max(worst, report.maxError[i]);
+	return worst;
+}
+
+//! Mark the candidates that no other candidate beats in both time and accuracy
+static void markPareto(std::vector<CandidateReport> &reports){
+	for (size_t i = 0; i < reports.size(); i++){
+		if (!reports[i].error.empty())
+			continue;
+		double time = reports[i].phTime, error = worstError(reports[i]);
+		reports[i].pareto = true;
+		for (size_t j = 0; j < reports.size(); j++){
+			if (j == i || !reports[j].error.empty())
+				continue;
+			double otherTime = reports[j].phTime, otherError = worstError(reports[j]);
+			if (otherTime <= time && otherError <= error && (otherTime < time || otherError < error))
+				reports[i].pareto = false;
+		}
+	}
+}
+
+//! Format a number for JSON, NaN is written as null
+static string jsonNumber(double value){
+	if (std::isnan(value))
+		return "null";
+	if (std::isinf(value))
+		return "1e308";
+	std::ostringstream number;
+	number.precision(9);
+	number << value;
+	return number.str();
+}
+
+//! Escape a string for JSON output
+static string jsonString(const string &value){
+	string escaped = "\"";
+	for (size_t i = 0; i < value.size(); i++){
+		if (value[i] == '"' || value[i] == '\\')
+			escaped += '\\';
+		if ((unsigned char)value[i] >= 0x20)
+			escaped += value[i];
+	}
+	return escaped + "\"";
+}
+
+static void usage(){
+	std::cerr << "Usage: externalmedia_backends [--candidate S] [--reference S] [--min-time T] [--json FILE] substance" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char *argv[]){
+	std::vector<string> candidates;
+	string substance, reference, jsonFile;
+	double minTime = 0.2;
+	for (int i = 1; i < argc; i++){
+		string arg = argv[i];
+		if (arg == "--candidate" && i + 1 < argc)
+			candidates.push_back(argv[++i]);
+		else if (arg == "--reference" && i + 1 < argc)
+			reference = argv[++i];
+		else if (arg == "--min-time" && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (arg == "--json" && i + 1 < argc)
+			jsonFile = argv[++i];
+		else if (substance.empty() && arg.compare(0, 2, "--"))
+			substance = arg;
+		else
+			usage();
+	}
+	if (substance.empty() || minTime <= 0)
+		usage();
+
+	// Default candidates, the substance may already name a backend
+	size_t pos = substance.find("::");
+	string backend = pos == string::npos ? "HEOS" : substance.substr(0, pos);
+	string fluid = pos == string::npos ? substance : substance.substr(pos + 2);
+	if (reference.empty())
+		reference = backend + "::" + fluid;
+	if (candidates.empty()){
+		candidates.push_back(backend + "::" + fluid);
+		if (backend != "INCOMP"){
+			candidates.push_back(backend + "::" + fluid + "|enable_TTSE=1");
+			candidates.push_back(backend + "::" + fluid + "|enable_BICUBIC=1");
+			candidates.push_back(backend + "::" + fluid + "|twophase_spline_table=200");
+			if (fluid == "Water")
+				candidates.push_back("IF97::Water");
+		}
+	}
+
+	Workload workload;
+	try {
+		sampleWorkload(reference.c_str(), workload);
+	} catch (BackendError &e){
+		std::cerr << "externalmedia_backends: the reference " << reference << " failed: " << e.what() << std::endl;
+		return 1;
+	}
+	if (workload.p.empty()){
+		std::cerr << "externalmedia_backends: no valid sample points for " << reference << std::endl;
+		return 1;
+	}
+
+	std::vector<CandidateReport> reports;
+	for (size_t i = 0; i < candidates.size(); i++)
+		reports.push_back(runCandidate(candidates[i], workload, minTime));
+	markPareto(reports);
+
+	// Text report
+	std::cout << std::endl << "Reference: " << reference << ", " << workload.p.size() << " state points, "
+	          << workload.psat.size() << " saturation points" << std::endl << std::endl;
+	char line[512];
+	snprintf(line, sizeof(line), "%-45s %10s %11s %13s %12s %12s %9s %10s  %s",
+		"candidate", "setup[ms]", "memory[MB]", "estimate[MB]", "ph[ns/call]", "sat[ns/call]", "failures", "max error", "pareto");
+	std::cout << line << std::endl;
+	for (size_t i = 0; i < reports.size(); i++){
+		const CandidateReport &r = reports[i];
+		if (!r.error.empty()){
+			std::cout << r.substance << ": " << r.error << std::endl;
+			continue;
+		}
+		snprintf(line, sizeof(line), "%-45s %10.1f %11.1f %13.1f %12.1f %12.1f %9ld %10.2e  %s",
+			r.substance.c_str(), r.setupTime*1e3, r.memory/1048576, r.memoryEstimate/1048576, r.phTime, r.satTime, r.failures, worstError(r), r.pareto ? "*" : "");
+		std::cout << line << std::endl;
+	}
+	std::cout << std::endl << "Maximum / mean relative error per property" << std::endl;
+	snprintf(line, sizeof(line), "%-45s", "candidate");
+	string header = line;
+	for (int j = 0; j < nProperties; j++){
+		snprintf(line, sizeof(line), " %19s", _propertyNames[j]);
+		header += line;
+	}
+	std::cout << header << std::endl;
+	for (size_t i = 0; i < reports.size(); i++){
+		const CandidateReport &r = reports[i];
+		if (!r.error.empty())
+			continue;
+		snprintf(line, sizeof(line), "%-45s", r.substance.c_str());
+		string row = line;
+		for (int j = 0; j < nProperties; j++){
+			snprintf(line, sizeof(line), " %9.2e/%9.2e", r.maxError[j], r.meanError[j]);
+			row += line;
+		}
+		std::cout << row << std::endl;
+	}
+
+	if (!jsonFile.empty()){
+		std::ostringstream json;
+		json << "{\n  \"substance\": " << jsonString(substance) << ",\n  \"reference\": " << jsonString(reference)
+		     << ",\n  \"state_points\": " << workload.p.size() << ",\n  \"saturation_points\": " << workload.psat.size()
+		     << ",\n  \"candidates\": [";
+		for (size_t i = 0; i < reports.size(); i++){
+			const CandidateReport &r = reports[i];
+			json << (i > 0 ? ",\n" : "\n") << "    {\"substance\": " << jsonString(r.substance);
+			if (!r.error.empty()){
+				json << ", \"error\": " << jsonString(r.error) << "}";
+				continue;
+			}
+			json << ", \"setup_time\": " << jsonNumber(r.setupTime) << ", \"memory\": " << jsonNumber(r.memory)
+			     << ", \"memory_estimate\": " << jsonNumber(r.memoryEstimate)
+			     << ", \"setState_ph_ns\": " << jsonNumber(r.phTime) << ", \"setSat_p_ns\": " << jsonNumber(r.satTime)
+			     << ", \"failures\": " << r.failures << ", \"pareto\": " << (r.pareto ? "true" : "false") << ",\n      \"errors\": {";
+			for (int j = 0; j < nProperties; j++)
+				json << (j > 0 ? ", " : "") << "\"" << _propertyNames[j] << "\": [" << jsonNumber(r.maxError[j]) << ", " << jsonNumber(r.meanError[j]) << "]";
+			json << "}}";
+		}
+		json << (reports.empty() ? "]\n}\n" : "\n  ]\n}\n");
+		std::ofstream file(jsonFile.c_str());
+		file << json.str();
+		if (!file){
+			std::cerr << "externalmedia_backends: could not write " << jsonFile << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,646 @@
+/*
+  externalmedia_benchmark
+
+  Measures the time per call of the functions of the C interface
+  (externalmedialib.h) for a matrix of fluids and thermodynamic regions.
+  Each function is called repeatedly on a set of slightly different points
+  of the region until the minimum time has elapsed.
+
+  Usage: externalmedia_benchmark [options]
+    --fluid NAME     only run the given fluid, can be repeated
+    --function NAME  only run the given function, can be repeated
+    --gate           only run the functions covered by the regression gate:
+                     solver lookup, setState, setSat and saturation functions
+    --min-time T     minimum time per function and region in seconds,
+                     default 0.02
+    --repeat N       repeat each measurement N times and keep the fastest
+    --json FILE      also write the results to a JSON file
+    --baseline FILE  compare with the results in FILE, written with --json,
+                     and fail if a function is slower than the tolerance
+    --tolerance X    allowed relative slowdown, default 0.25, stored in the
+                     JSON file; the baseline value is used with --baseline
+                     and entries of the baseline may have their own
+
+  The fluids are Water, CO2, R245fa, R407c and the incompressible brine
+  MEG30 (CoolProp INCOMP::MEG[0.3]), the regions are subcooled, two-phase,
+  superheated, supercritical and near-critical (liquid for the brine).
+  The functions returning fluid constants only look up the solver, they are
+  run once per fluid in the region "constants". Without CoolProp, the
+  TestMedium solver is benchmarked instead.
+
+  To compare machines of different speed, each run times a fixed reference
+  workload, and the baseline timings are scaled with the ratio of the current
+  and the recorded reference time. With --baseline, only the entries of the
+  baseline are run, and the exit code is 1 if any of them is slower than
+  allowed, failed or is missing. Entries that failed when the baseline was
+  recorded, like the functions a solver does not implement, are listed as
+  skipped and not run.
+
+  The library is compiled into the tool, ModelicaError is implemented by
+  throwing an exception, so functions that fail are reported and skipped.
+*/
+
+#include "externalmedialib.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if EXTERNALMEDIA_COOLPROP
+#include "CoolProp.h"
+#endif
+
+#ifdef WIN32
+#define BENCHMARK_EXPORT __declspec(dllexport)
+#else
+#define BENCHMARK_EXPORT
+#endif
+
+using std::string;
+
+/*! Error reported by the library through ModelicaError */
+class BenchmarkError : public std::runtime_error{
+public:
+	BenchmarkError(const char *message) : std::runtime_error(message){}
+};
+
+extern "C" {
+	BENCHMARK_EXPORT void ModelicaError(const char *string){
+		throw BenchmarkError(string);
+	}
+	BENCHMARK_EXPORT void ModelicaWarning(const char *string){
+	}
+}
+
+/*! Fluid of the benchmark matrix */
+struct BenchmarkFluid{
+	const char *name;
+	const char *libraryName;
+	const char *substanceName;
+	bool incompressible;
+};
+
+#if EXTERNALMEDIA_COOLPROP
+static const BenchmarkFluid _fluids[] = {
+	{"Water", "CoolProp", "Water", false},
+	{"CO2", "CoolProp", "CO2", false},
+	{"R245fa", "CoolProp", "R245fa", false},
+	{"R407c", "CoolProp", "R407c", false},
+	{"MEG30", "CoolProp", "INCOMP::MEG[0.3]", true}
+};
+#else
+static const BenchmarkFluid _fluids[] = {
+	{"TestMedium", "TestMedium", "TestMedium", false}
+};
+#endif
+static const int _nFluids = sizeof(_fluids)/sizeof(_fluids[0]);
+
+/*! Thermodynamic regions */
+enum BenchmarkRegion { constants, subcooled, twoPhase, superheated, supercritical, nearCritical, liquid, nRegions };
+
+static const char *_regionNames[nRegions] = {
+	"constants", "subcooled", "two-phase", "superheated", "supercritical", "near-critical", "liquid"
+};
+
+/*! Point of a region with all inputs of the benchmarked functions */
+struct BenchmarkPoint{
+	double p, T, d, h, s, u;
+	ExternalThermodynamicState state;
+	ExternalSaturationProperties sat;
+	/* Output of the benchmarked setState and setSat functions */
+	ExternalThermodynamicState outState;
+	ExternalSaturationProperties outSat;
+};
+
+/*! Number of points per region, the calls cycle through them */
+static const int _nPoints = 16;
+
+/*! Groups of functions, which decide in which regions they are run */
+enum FunctionGroup { constantFunction, stateFunction, singlePhaseFunction, propertyFunction, saturationFunction };
+
+typedef void (*BenchmarkCall)(BenchmarkPoint &x, const BenchmarkFluid &f);
+
+/*! Benchmarked function */
+struct BenchmarkFunction{
+	const char *name;
+	FunctionGroup group;
+	BenchmarkCall call;
+};
+
+/* Results of the property functions are stored here, so the calls cannot be optimised away */
+static volatile double _sink;
+
+#define FLUID f.name, f.libraryName, f.substanceName
+#define CONSTANT(name) {#name, constantFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_##name##_C_impl(FLUID); }}
+#define PROPERTY(name) {#name, propertyFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_##name##_C_impl(&x.state, FLUID); }}
+#define SATURATION(name) {#name, saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_##name##_C_impl(&x.sat, FLUID); }}
+
+static const BenchmarkFunction _functions[] = {
+	CONSTANT(getMolarMass),
+	CONSTANT(getCriticalTemperature),
+	CONSTANT(getCriticalPressure),
+	CONSTANT(getCriticalMolarVolume),
+	{"setState_ph", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_ph_C_impl(x.p, x.h, 0, &x.outState, FLUID); }},
+	{"setState_pT", singlePhaseFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_pT_C_impl(x.p, x.T, &x.outState, FLUID); }},
+	{"setState_dT", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_dT_C_impl(x.d, x.T, 0, &x.outState, FLUID); }},
+	{"setState_ps", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_ps_C_impl(x.p, x.s, 0, &x.outState, FLUID); }},
+	{"setState_hs", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_hs_C_impl(x.h, x.s, 0, &x.outState, FLUID); }},
+	{"setState_du", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_du_C_impl(x.d, x.u, 0, &x.outState, FLUID); }},
+	{"setState_dh", stateFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setState_dh_C_impl(x.d, x.h, 0, &x.outState, FLUID); }},
+	{"partialDeriv_state", propertyFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_partialDeriv_state_C_impl("d", "p", "h", &x.state, FLUID); }},
+	PROPERTY(prandtlNumber),
+	PROPERTY(temperature),
+	PROPERTY(velocityOfSound),
+	PROPERTY(isobaricExpansionCoefficient),
+	PROPERTY(specificHeatCapacityCp),
+	PROPERTY(specificHeatCapacityCv),
+	PROPERTY(density),
+	PROPERTY(density_derh_p),
+	PROPERTY(density_derp_h),
+	PROPERTY(dynamicViscosity),
+	PROPERTY(specificEnthalpy),
+	PROPERTY(isothermalCompressibility),
+	PROPERTY(thermalConductivity),
+	PROPERTY(pressure),
+	PROPERTY(specificEntropy),
+	PROPERTY(density_ph_der),
+	{"isentropicEnthalpy", propertyFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_isentropicEnthalpy_C_impl(0.5*x.p, &x.state, FLUID); }},
+	{"setSat_p", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setSat_p_C_impl(x.sat.psat, &x.outSat, FLUID); }},
+	{"setSat_T", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setSat_T_C_impl(x.sat.Tsat, &x.outSat, FLUID); }},
+	{"setBubbleState", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setBubbleState_C_impl(&x.sat, 1, &x.outState, FLUID); }},
+	{"setDewState", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ TwoPhaseMedium_setDewState_C_impl(&x.sat, 1, &x.outState, FLUID); }},
+	{"saturationTemperature", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_saturationTemperature_C_impl(x.sat.psat, FLUID); }},
+	{"saturationTemperature_derp", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_saturationTemperature_derp_C_impl(x.sat.psat, FLUID); }},
+	SATURATION(saturationTemperature_derp_sat),
+	SATURATION(dBubbleDensity_dPressure),
+	SATURATION(dDewDensity_dPressure),
+	SATURATION(dBubbleEnthalpy_dPressure),
+	SATURATION(dDewEnthalpy_dPressure),
+	SATURATION(bubbleDensity),
+	SATURATION(dewDensity),
+	SATURATION(bubbleEnthalpy),
+	SATURATION(dewEnthalpy),
+	{"saturationPressure", saturationFunction, [](BenchmarkPoint &x, const BenchmarkFluid &f){ _sink = TwoPhaseMedium_saturationPressure_C_impl(x.sat.Tsat, FLUID); }},
+	SATURATION(surfaceTension),
+	SATURATION(bubbleEntropy),
+	SATURATION(dewEntropy)
+};
+static const int _nFunctions = sizeof(_functions)/sizeof(_functions[0]);
+
+/*! Functions covered by the regression gate */
+static const char *_gateFunctions[] = {
+	"getMolarMass",
+	"setState_ph", "setState_pT", "setState_dT", "setState_ps", "setState_hs", "setState_du", "setState_dh",
+	"setSat_p", "setSat_T", "setBubbleState", "setDewState", "saturationTemperature", "saturationPressure"
+};
+
+//! Return true if a function is run in a region
+static bool runsIn(FunctionGroup group, BenchmarkRegion region){
+	if (region == constants)
+		return group == constantFunction;
+	switch (group){
+		case constantFunction: return false;
+		case singlePhaseFunction: return region != twoPhase && region != nearCritical;
+		case saturationFunction: return region != supercritical && region != liquid;
+		default: return true;
+	}
+}
+
+//! Regions of a fluid
+static std::vector<BenchmarkRegion> fluidRegions(const BenchmarkFluid &fluid){
+	std::vector<BenchmarkRegion> regions(1, constants);
+	if (fluid.incompressible)
+		regions.push_back(liquid);
+	else {
+		regions.push_back(subcooled);
+		regions.push_back(twoPhase);
+		regions.push_back(superheated);
+		regions.push_back(supercritical);
+		regions.push_back(nearCritical);
+	}
+	return regions;
+}
+
+//! Compute the k-th point of a region
+/*!
+  The points differ by a relative 1e-4 in pressure and temperature, so
+  that the calls do not repeat identical inputs.
+*/
+static void regionPoint(const BenchmarkFluid &f, BenchmarkRegion region, int k, BenchmarkPoint &x){
+	x = BenchmarkPoint();
+	if (region == constants)
+		return;
+	double scale = 1 + 1e-4*k;
+	double pc = NAN, Tc = NAN, p = NAN;
+	if (region != liquid){
+		pc = TwoPhaseMedium_getCriticalPressure_C_impl(FLUID);
+		Tc = TwoPhaseMedium_getCriticalTemperature_C_impl(FLUID);
+		p = (region == nearCritical ? 0.98*pc : 0.3*pc)*scale;
+	}
+	if (region != supercritical && region != liquid)
+		TwoPhaseMedium_setSat_p_C_impl(p, &x.sat, FLUID);
+	switch (region){
+		case subcooled:
+			TwoPhaseMedium_setState_pT_C_impl(p, x.sat.Tsat - 10, &x.state, FLUID);
+			break;
+		case superheated:
+			TwoPhaseMedium_setState_pT_C_impl(p, x.sat.Tsat + 20, &x.state, FLUID);
+			break;
+		case twoPhase:
+		case nearCritical:
+			TwoPhaseMedium_setState_ph_C_impl(p, 0.5*(x.sat.hl + x.sat.hv), 0, &x.state, FLUID);
+			break;
+		case supercritical:
+			TwoPhaseMedium_setState_pT_C_impl(1.5*pc*scale, 1.2*Tc*scale, &x.state, FLUID);
+			break;
+		case liquid:
+			TwoPhaseMedium_setState_pT_C_impl(5e5*scale, 300*scale, &x.state, FLUID);
+			break;
+		default:
+			break;
+	}
+	x.p = x.state.p;
+	x.T = x.state.T;
+	x.d = x.state.d;
+	x.h = x.state.h;
+	x.s = x.state.s;
+	x.u = x.state.h - x.state.p/x.state.d;
+}
+
+/*! Result of one function in one region */
+struct BenchmarkResult{
+	string fluid, region, function;
+	long long calls;
+	double nsPerCall;
+	string error;
+};
+
+//! Time one function on the points of a region
+static BenchmarkResult run(const BenchmarkFunction &function, const BenchmarkFluid &fluid, BenchmarkRegion region,
+						   std::vector<BenchmarkPoint> &points, double minTime){
+	BenchmarkResult result;
+	result.fluid = fluid.name;
+	result.region = _regionNames[region];
+	result.function = function.name;
+	result.calls = 0;
+	result.nsPerCall = NAN;
+	try {
+		// One untimed pass, which also creates the solver and fills caches
+		for (size_t k = 0; k < points.size(); k++)
+			function.call(points[k], fluid);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double elapsed = 0;
+		do {
+			for (size_t k = 0; k < points.size(); k++)
+				function.call(points[k], fluid);
+			result.calls += points.size();
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (elapsed < minTime);
+		result.nsPerCall = elapsed*1e9/result.calls;
+	} catch (BenchmarkError &e){
+		result.error = e.what();
+	}
+	return result;
+}
+
+//! Time of a fixed reference workload in nanoseconds
+/*!
+  The workload mixes string handling, like the solver lookup, with floating
+  point functions, like the property calls. The fastest of five runs is used.
+*/
+static double calibrationTime(){
+	const int n = 100000;
+	double best = INFINITY;
+	for (int r = 0; r < 5; r++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double x = 1;
+		string key;
+		for (int i = 0; i < n; i++){
+			key = "CoolProp.Water";
+			key += (char)('a' + i % 26);
+			x = exp(-1e-3*x) + sqrt(x + key.size());
+		}
+		_sink = x;
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()*1e9/n);
+	}
+	return best;
+}
+
+//! Escape a string for JSON output
+static string jsonString(const string &value){
+	string escaped = "\"";
+	for (size_t i = 0; i < value.size(); i++){
+		if (value[i] == '"' || value[i] == '\\')
+			escaped += '\\';
+		if ((unsigned char)value[i] >= 0x20)
+			escaped += value[i];
+	}
+	return escaped + "\"";
+}
+
+//! Find the value of a key in a flat JSON object
+/*!
+  Only handles the files written by this tool: strings are returned without
+  the quotes, other values as they are written.
+  @return false if the key is not found
+*/
+static bool jsonValue(const string &object, const string &key, string &value){
+	size_t pos = object.find("\"" + key + "\":");
+	if (pos == string::npos)
+		return false;
+	pos = object.find_first_not_of(" \t\r\n", pos + key.size() + 3);
+	if (pos == string::npos)
+		return false;
+	value.clear();
+	if (object[pos] == '"'){
+		for (pos++; pos < object.size() && object[pos] != '"'; pos++){
+			if (object[pos] == '\\')
+				pos++;
+			if (pos < object.size())
+				value += object[pos];
+		}
+		return true;
+	}
+	size_t end = object.find_first_of(",}] \t\r\n", pos);
+	value = object.substr(pos, end == string::npos ? string::npos : end - pos);
+	return true;
+}
+
+//! Return a number of a flat JSON object, NaN if it is missing or null
+static double jsonNumber(const string &object, const string &key){
+	string value;
+	if (!jsonValue(object, key, value) || value == "null")
+		return NAN;
+	return atof(value.c_str());
+}
+
+/*! Entry of a baseline file */
+struct BaselineEntry{
+	string fluid, region, function;
+	double nsPerCall, tolerance;
+	string error; /* error of the recorded run, the entry is skipped */
+};
+
+/*! Baseline file */
+struct Baseline{
+	double calibration, tolerance;
+	std::vector<BaselineEntry> entries;
+};
+
+//! Read a baseline file written with --json
+static void readBaseline(const string &fileName, Baseline &baseline){
+	std::ifstream file(fileName.c_str());
+	if (!file)
+		throw std::runtime_error("could not open the baseline " + fileName);
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	string text = buffer.str();
+	size_t results = text.find("\"results\":");
+	if (results == string::npos)
+		throw std::runtime_error(fileName + " is not a benchmark result file");
+	string header = text.substr(0, results);
+	baseline.calibration = jsonNumber(header, "calibration_ns");
+	baseline.tolerance = jsonNumber(header, "tolerance");
+
+	// The result objects are flat, braces within strings are skipped
+	size_t pos = results;
+	while ((pos = text.find('{', pos)) != string::npos){
+		size_t end = pos + 1;
+		bool inString = false;
+		for (; end < text.size() && (inString || text[end] != '}'); end++){
+			if (text[end] == '\\')
+				end++;
+			else if (text[end] == '"')
+				inString = !inString;
+		}
+		string object = text.substr(pos, end - pos + 1);
+		BaselineEntry entry;
+		if (!jsonValue(object, "fluid", entry.fluid) || !jsonValue(object, "region", entry.region) || !jsonValue(object, "function", entry.function))
+			throw std::runtime_error("invalid result in the baseline " + fileName);
+		entry.nsPerCall = jsonNumber(object, "ns_per_call");
+		if (!jsonValue(object, "error", entry.error) && std::isnan(entry.nsPerCall))
+			entry.error = "no timing";
+		entry.tolerance = jsonNumber(object, "tolerance");
+		if (std::isnan(entry.tolerance))
+			entry.tolerance = baseline.tolerance;
+		baseline.entries.push_back(entry);
+		pos = end;
+	}
+}
+
+//! Return the baseline entry of a result, NULL if there is none
+static const BaselineEntry *findEntry(const Baseline &baseline, const string &fluid, const string &region, const string &function){
+	for (size_t i = 0; i < baseline.entries.size(); i++){
+		const BaselineEntry &e = baseline.entries[i];
+		if (e.fluid == fluid && e.region == region && e.function == function)
+			return &e;
+	}
+	return NULL;
+}
+
+//! Compare the results with a baseline and print the per-function report
+/*!
+  @return Number of entries that are slower than allowed, failed or are missing
+*/
+static int compareBaseline(const Baseline &baseline, const std::vector<BenchmarkResult> &results, double calibration){
+	double scale = (baseline.calibration > 0 && calibration > 0) ? calibration/baseline.calibration : 1;
+	char line[512];
+	std::cout << std::endl << "Comparison with the baseline, reference workload " << calibration << " ns (baseline "
+	          << baseline.calibration << " ns), baseline timings scaled by " << scale << std::endl;
+	snprintf(line, sizeof(line), "%-30s %-10s %-14s %12s %12s %9s %9s  %s",
+		"function", "fluid", "region", "expected", "current", "delta", "allowed", "status");
+	std::cout << line << std::endl;
+	int failed = 0, compared = 0, skipped = 0;
+	for (size_t i = 0; i < baseline.entries.size(); i++){
+		const BaselineEntry &e = baseline.entries[i];
+		if (!e.error.empty()){
+			skipped++;
+			snprintf(line, sizeof(line), "%-30s %-10s %-14s %12s %12s %9s %9s  skipped, failed in the baseline: %s",
+				e.function.c_str(), e.fluid.c_str(), e.region.c_str(), "-", "-", "-", "-", e.error.c_str());
+			std::cout << line << std::endl;
+			continue;
+		}
+		compared++;
+		const BenchmarkResult *result = NULL;
+		for (size_t j = 0; j < results.size(); j++)
+			if (results[j].fluid == e.fluid && results[j].region == e.region && results[j].function == e.function)
+				result = &results[j];
+		double expected = e.nsPerCall*scale;
+		double current = result ? result->nsPerCall : NAN;
+		double delta = current/expected - 1;
+		const char *status = "ok";
+		if (!result)
+			status = "MISSING";
+		else if (!result->error.empty())
+			status = "FAILED";
+		else if (delta > e.tolerance)
+			status = "SLOWER";
+		else if (delta < -e.tolerance)
+			status = "faster, update the baseline";
+		if (!result || !result->error.empty() || delta > e.tolerance)
+			failed++;
+		snprintf(line, sizeof(line), "%-30s %-10s %-14s %12.1f %12.1f %+8.1f%% %8.1f%%  %s",
+			e.function.c_str(), e.fluid.c_str(), e.region.c_str(), expected, current, delta*100, e.tolerance*100, status);
+		std::cout << line << std::endl;
+	}
+	if (failed)
+		std::cout << std::endl << "Performance regression in " << failed << " of " << compared << " entries";
+	else
+		std::cout << std::endl << "All " << compared << " entries are within the tolerance";
+	if (skipped)
+		std::cout << ", " << skipped << " entries skipped";
+	std::cout << std::endl;
+	return failed;
+}
+
+static bool selected(const std::vector<string> &filter, const char *name){
+	if (filter.empty())
+		return true;
+	for (size_t i = 0; i < filter.size(); i++)
+		if (filter[i] == name)
+			return true;
+	return false;
+}
+
+static void usage(){
+	std::cerr << "Usage: externalmedia_benchmark [--fluid NAME] [--function NAME] [--gate] [--min-time T] [--repeat N]"
+	             " [--json FILE] [--baseline FILE] [--tolerance X]" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char *argv[]){
+	std::vector<string> fluidFilter, functionFilter;
+	double minTime = 0.02, tolerance = 0.25;
+	int repeat = 1;
+	string jsonFile, baselineFile;
+	for (int i = 1; i < argc; i++){
+		string arg = argv[i];
+		if (arg == "--fluid" && i + 1 < argc)
+			fluidFilter.push_back(argv[++i]);
+		else if (arg == "--function" && i + 1 < argc)
+			functionFilter.push_back(argv[++i]);
+		else if (arg == "--gate")
+			functionFilter.insert(functionFilter.end(), _gateFunctions, _gateFunctions + sizeof(_gateFunctions)/sizeof(_gateFunctions[0]));
+		else if (arg == "--min-time" && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (arg == "--repeat" && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (arg == "--json" && i + 1 < argc)
+			jsonFile = argv[++i];
+		else if (arg == "--baseline" && i + 1 < argc)
+			baselineFile = argv[++i];
+		else if (arg == "--tolerance" && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else
+			usage();
+	}
+	if (minTime <= 0 || repeat < 1 || tolerance < 0)
+		usage();
+
+	Baseline baseline;
+	if (!baselineFile.empty()){
+		try {
+			readBaseline(baselineFile, baseline);
+		} catch (std::exception &e){
+			std::cerr << "externalmedia_benchmark: " << e.what() << std::endl;
+			return 1;
+		}
+		if (std::isnan(baseline.tolerance))
+			baseline.tolerance = tolerance;
+		// Entries excluded with --fluid or --function are not compared
+		std::vector<BaselineEntry> entries;
+		for (size_t i = 0; i < baseline.entries.size(); i++){
+			BaselineEntry &e = baseline.entries[i];
+			if (std::isnan(e.tolerance))
+				e.tolerance = baseline.tolerance;
+			if (selected(fluidFilter, e.fluid.c_str()) && selected(functionFilter, e.function.c_str()))
+				entries.push_back(e);
+		}
+		baseline.entries.swap(entries);
+		tolerance = baseline.tolerance;
+	}
+	double calibration = calibrationTime();
+
+	std::vector<BenchmarkResult> results;
+	char line[512];
+	snprintf(line, sizeof(line), "%-10s %-14s %-30s %12s %12s", "fluid", "region", "function", "calls", "ns/call");
+	std::cout << line << std::endl;
+	for (int i = 0; i < _nFluids; i++){
+		const BenchmarkFluid &fluid = _fluids[i];
+		if (!selected(fluidFilter, fluid.name))
+			continue;
+		std::vector<BenchmarkRegion> regions = fluidRegions(fluid);
+		for (size_t r = 0; r < regions.size(); r++){
+			std::vector<BenchmarkPoint> points(_nPoints);
+			try {
+				for (int k = 0; k < _nPoints; k++)
+					regionPoint(fluid, regions[r], k, points[k]);
+			} catch (BenchmarkError &e){
+				std::cerr << "Skipping " << fluid.name << ", " << _regionNames[regions[r]] << ": " << e.what() << std::endl;
+				continue;
+			}
+			for (int j = 0; j < _nFunctions; j++){
+				if (!runsIn(_functions[j].group, regions[r]) || !selected(functionFilter, _functions[j].name))
+					continue;
+				if (!baselineFile.empty()){
+					const BaselineEntry *entry = findEntry(baseline, fluid.name, _regionNames[regions[r]], _functions[j].name);
+					if (!entry || !entry->error.empty())
+						continue;
+				}
+				BenchmarkResult result = run(_functions[j], fluid, regions[r], points, minTime);
+				for (int n = 1; n < repeat && result.error.empty(); n++){
+					BenchmarkResult again = run(_functions[j], fluid, regions[r], points, minTime);
+					if (!again.error.empty() || again.nsPerCall < result.nsPerCall)
+						result = again;
+				}
+				if (result.error.empty())
+					snprintf(line, sizeof(line), "%-10s %-14s %-30s %12lld %12.1f", fluid.name, result.region.c_str(), result.function.c_str(), result.calls, result.nsPerCall);
+				else
+					snprintf(line, sizeof(line), "%-10s %-14s %-30s %12s %12s", fluid.name, result.region.c_str(), result.function.c_str(), "-", "error");
+				std::cout << line << std::endl;
+				results.push_back(result);
+			}
+		}
+	}
+
+	if (!jsonFile.empty()){
+		std::ostringstream json;
+		json.precision(9);
+#if EXTERNALMEDIA_COOLPROP
+		json << "{\n  \"coolprop_version\": " << jsonString(CoolProp::get_global_param_string("version"))
+		     << ",\n  \"coolprop_revision\": " << jsonString(CoolProp::get_global_param_string("gitrevision")) << ",";
+#else
+		json << "{\n  \"coolprop_version\": null,\n  \"coolprop_revision\": null,";
+#endif
+		json << "\n  \"calibration_ns\": " << calibration << ",\n  \"tolerance\": " << tolerance
+		     << ",\n  \"min_time\": " << minTime << ",\n  \"repeat\": " << repeat << ",\n  \"results\": [";
+		for (size_t i = 0; i < results.size(); i++){
+			const BenchmarkResult &r = results[i];
+			json << (i > 0 ? ",\n" : "\n") << "    {\"fluid\": " << jsonString(r.fluid) << ", \"region\": " << jsonString(r.region)
+			     << ", \"function\": " << jsonString(r.function) << ", \"calls\": " << r.calls << ", \"ns_per_call\": ";
+			if (r.error.empty())
+				json << r.nsPerCall << "}";
+			else
+				json << "null, \"error\": " << jsonString(r.error) << "}";
+		}
+		json << (results.empty() ? "]\n}\n" : "\n  ]\n}\n");
+		std::ofstream file(jsonFile.c_str());
+		file << json.str();
+		if (!file){
+			std::cerr << "externalmedia_benchmark: could not write " << jsonFile << std::endl;
+			return 1;
+		}
+	}
+
+	if (!baselineFile.empty() && compareBaseline(baseline, results, calibration) > 0)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,544 @@
+/*
+  externalmedia_replay
+
+  Replays a call trace recorded with EXTERNALMEDIA_TRACE (see trace.h)
+  against the library and reports throughput, latency percentiles and the
+  deviation of the outputs from the recorded values.
+
+  Usage: externalmedia_replay [options] trace_file
+    --backend B    CoolProp backend used instead of the recorded one,
+                   e.g. HEOS, TTSE&HEOS, BICUBIC&HEOS, IF97
+    --option k=v   CoolProp solver option added to the substance names,
+                   e.g. twophase_spline_table=200, can be repeated
+    --threads N    replay the trace in N threads, each with its own solvers
+    --repeat N     replay the trace N times in each thread
+    --json FILE    also write the report to a JSON file
+    --tolerance X  exit with code 1 if a call fails, or if an output deviates
+                   from the recorded value by more than X or only one of
+                   them is NaN
+
+  The library is compiled into the tool, ModelicaError is implemented by
+  throwing an exception, so failed calls are counted and skipped.
+*/
+
+#include "externalmedialib.h"
+#include "statistics.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define REPLAY_EXPORT __declspec(dllexport)
+#else
+#define REPLAY_EXPORT
+#endif
+
+/*! Error reported by the library through ModelicaError */
+class ReplayError : public std::runtime_error{
+public:
+	ReplayError(const char *message) : std::runtime_error(message){}
+};
+
+extern "C" {
+	REPLAY_EXPORT void ModelicaError(const char *string){
+		throw ReplayError(string);
+	}
+	REPLAY_EXPORT void ModelicaWarning(const char *string){
+	}
+}
+
+/*! Solver record of the trace */
+struct ReplaySolver{
+	string mediumName, libraryName, substanceName;
+};
+
+/*! Call record of the trace, the values are stored in ReplayTrace::values */
+struct ReplayCall{
+	int function;
+	int solver;
+	int nIn, nOut;
+	size_t values; /* index of the first input value */
+	size_t text;   /* index of the first string */
+	int nText;
+};
+
+/*! Complete trace */
+struct ReplayTrace{
+	std::vector<ReplaySolver> solvers;
+	std::vector<ReplayCall> calls;
+	std::vector<double> values;
+	std::vector<string> text;
+};
+
+//! Read a value from the trace file
+template <class T> static T get(std::ifstream &file){
+	T value;
+	file.read(reinterpret_cast<char*>(&value), sizeof(T));
+	if (!file)
+		throw std::runtime_error("unexpected end of the trace file");
+	return value;
+}
+
+static string getString(std::ifstream &file){
+	unsigned short length = get<unsigned short>(file);
+	string text(length, '\0');
+	if (length > 0)
+		file.read(&text[0], length);
+	if (!file)
+		throw std::runtime_error("unexpected end of the trace file");
+	return text;
+}
+
+//! Read a trace file
+static void readTrace(const string &fileName, ReplayTrace &trace){
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	if (!file)
+		throw std::runtime_error("could not open the trace file " + fileName);
+	char magic[8];
+	file.read(magic, 8);
+	if (!file || memcmp(magic, "EMTRACE", 8))
+		throw std::runtime_error(fileName + " is not an ExternalMedia trace file");
+	unsigned int version = get<unsigned int>(file);
+	if (version != CallTrace::version)
+		throw std::runtime_error("unsupported trace format version");
+
+	// Map the recorded function ids to the current ones by name
+	std::vector<int> functionIds(get<unsigned short>(file), -1);
+	for (size_t i = 0; i < functionIds.size(); i++){
+		string name = getString(file);
+		for (int j = 0; j < Statistics::nFunctions; j++)
+			if (name == Statistics::functionName((Statistics::Function)j))
+				functionIds[i] = j;
+	}
+
+	std::vector<int> solverIds;
+	int type;
+	while ((type = file.get()) != EOF){
+		if (type == 1){
+			unsigned short id = get<unsigned short>(file);
+			ReplaySolver solver;
+			solver.mediumName = getString(file);
+			solver.libraryName = getString(file);
+			solver.substanceName = getString(file);
+			if (solverIds.size() <= id)
+				solverIds.resize(id + 1, -1);
+			solverIds[id] = (int)trace.solvers.size();
+			trace.solvers.push_back(solver);
+		}
+		else if (type == 2){
+			ReplayCall call;
+			unsigned char function = get<unsigned char>(file);
+			unsigned short solver = get<unsigned short>(file);
+			call.nIn = get<unsigned char>(file);
+			call.nOut = get<unsigned char>(file);
+			call.nText = get<unsigned char>(file);
+			call.values = trace.values.size();
+			for (int i = 0; i < call.nIn + call.nOut; i++)
+				trace.values.push_back(get<double>(file));
+			call.text = trace.text.size();
+			for (int i = 0; i < call.nText; i++)
+				trace.text.push_back(getString(file));
+			if (function >= functionIds.size() || functionIds[function] < 0 || solver >= solverIds.size() || solverIds[solver] < 0)
+				throw std::runtime_error("invalid call record in the trace file");
+			call.function = functionIds[function];
+			call.solver = solverIds[solver];
+			trace.calls.push_back(call);
+		}
+		else
+			throw std::runtime_error("invalid record type in the trace file");
+	}
+}
+
+/*! Replay settings */
+struct ReplaySettings{
+	string backend;
+	std::vector<string> options;
+	int threads, repeat;
+	string jsonFile;
+	double tolerance; /* NaN if the outputs are not checked */
+};
+
+//! Apply the backend and option overrides to a CoolProp substance name
+static string overrideSubstance(const string &substanceName, const ReplaySettings &settings){
+	std::vector<string> parts;
+	std::stringstream stream(substanceName);
+	string part;
+	while (std::getline(stream, part, '|'))
+		parts.push_back(part);
+	if (parts.empty())
+		parts.push_back("");
+	if (!settings.backend.empty()){
+		size_t pos = parts[0].find("::");
+		parts[0] = settings.backend + "::" + (pos == string::npos ? parts[0] : parts[0].substr(pos + 2));
+	}
+	for (size_t i = 0; i < settings.options.size(); i++){
+		string key = settings.options[i].substr(0, settings.options[i].find('='));
+		for (size_t j = parts.size() - 1; j > 0; j--)
+			if (parts[j].substr(0, parts[j].find('=')) == key)
+				parts.erase(parts.begin() + j);
+		parts.push_back(settings.options[i]);
+	}
+	string result = parts[0];
+	for (size_t i = 1; i < parts.size(); i++)
+		result += "|" + parts[i];
+	return result;
+}
+
+//! Solver names used by one thread
+/*!
+  The CoolProp solvers of thread n > 0 use the library name "CoolProp#n",
+  which creates separate solver instances for each thread.
+*/
+static std::vector<ReplaySolver> threadSolvers(const ReplayTrace &trace, const ReplaySettings &settings, int thread){
+	std::vector<ReplaySolver> solvers = trace.solvers;
+	for (size_t i = 0; i < solvers.size(); i++){
+		if (solvers[i].libraryName.find("CoolProp") != 0)
+			continue;
+		solvers[i].substanceName = overrideSubstance(solvers[i].substanceName, settings);
+		if (thread > 0){
+			size_t pos = solvers[i].libraryName.find('|');
+			std::ostringstream suffix;
+			suffix << "#" << thread;
+			solvers[i].libraryName.insert(pos == string::npos ? solvers[i].libraryName.size() : pos, suffix.str());
+		}
+	}
+	return solvers;
+}
+
+typedef double (*StateFunction)(void *state, const char *mediumName, const char *libraryName, const char *substanceName);
+typedef double (*SatFunction)(void *sat, const char *mediumName, const char *libraryName, const char *substanceName);
+
+//! Return the C interface function for state and saturation property functions
+static StateFunction stateFunction(int function){
+	switch (function){
+		case Statistics::prandtlNumber: return TwoPhaseMedium_prandtlNumber_C_impl;
+		case Statistics::temperature: return TwoPhaseMedium_temperature_C_impl;
+		case Statistics::velocityOfSound: return TwoPhaseMedium_velocityOfSound_C_impl;
+		case Statistics::isobaricExpansionCoefficient: return TwoPhaseMedium_isobaricExpansionCoefficient_C_impl;
+		case Statistics::specificHeatCapacityCp: return TwoPhaseMedium_specificHeatCapacityCp_C_impl;
+		case Statistics::specificHeatCapacityCv: return TwoPhaseMedium_specificHeatCapacityCv_C_impl;
+		case Statistics::density: return TwoPhaseMedium_density_C_impl;
+		case Statistics::density_derh_p: return TwoPhaseMedium_density_derh_p_C_impl;
+		case Statistics::density_derp_h: return TwoPhaseMedium_density_derp_h_C_impl;
+		case Statistics::dynamicViscosity: return TwoPhaseMedium_dynamicViscosity_C_impl;
+		case Statistics::specificEnthalpy: return TwoPhaseMedium_specificEnthalpy_C_impl;
+		case Statistics::isothermalCompressibility: return TwoPhaseMedium_isothermalCompressibility_C_impl;
+		case Statistics::thermalConductivity: return TwoPhaseMedium_thermalConductivity_C_impl;
+		case Statistics::pressure: return TwoPhaseMedium_pressure_C_impl;
+		case Statistics::specificEntropy: return TwoPhaseMedium_specificEntropy_C_impl;
+		case Statistics::density_ph_der: return TwoPhaseMedium_density_ph_der_C_impl;
+		default: return NULL;
+	}
+}
+
+static SatFunction satFunction(int function){
+	switch (function){
+		case Statistics::saturationTemperature_derp_sat: return TwoPhaseMedium_saturationTemperature_derp_sat_C_impl;
+		case Statistics::dBubbleDensity_dPressure: return TwoPhaseMedium_dBubbleDensity_dPressure_C_impl;
+		case Statistics::dDewDensity_dPressure: return TwoPhaseMedium_dDewDensity_dPressure_C_impl;
+		case Statistics::dBubbleEnthalpy_dPressure: return TwoPhaseMedium_dBubbleEnthalpy_dPressure_C_impl;
+		case Statistics::dDewEnthalpy_dPressure: return TwoPhaseMedium_dDewEnthalpy_dPressure_C_impl;
+		case Statistics::bubbleDensity: return TwoPhaseMedium_bubbleDensity_C_impl;
+		case Statistics::dewDensity: return TwoPhaseMedium_dewDensity_C_impl;
+		case Statistics::bubbleEnthalpy: return TwoPhaseMedium_bubbleEnthalpy_C_impl;
+		case Statistics::dewEnthalpy: return TwoPhaseMedium_dewEnthalpy_C_impl;
+		case Statistics::surfaceTension: return TwoPhaseMedium_surfaceTension_C_impl;
+		case Statistics::bubbleEntropy: return TwoPhaseMedium_bubbleEntropy_C_impl;
+		case Statistics::dewEntropy: return TwoPhaseMedium_dewEntropy_C_impl;
+		default: return NULL;
+	}
+}
+
+//! Replay one call
+/*!
+  @return Number of output values, the same layout as in the trace
+*/
+static int replayCall(const ReplayCall &call, const double *in, const string *text, const ReplaySolver &solver, double *out){
+	const char *m = solver.mediumName.c_str(), *l = solver.libraryName.c_str(), *s = solver.substanceName.c_str();
+	ExternalThermodynamicState state;
+	ExternalSaturationProperties sat;
+	switch (call.function){
+		case Statistics::setState_ph: TwoPhaseMedium_setState_ph_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setState_pT: TwoPhaseMedium_setState_pT_C_impl(in[0], in[1], &state, m, l, s); break;
+		case Statistics::setState_dT: TwoPhaseMedium_setState_dT_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setState_ps: TwoPhaseMedium_setState_ps_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setState_hs: TwoPhaseMedium_setState_hs_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setState_du: TwoPhaseMedium_setState_du_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setState_dh: TwoPhaseMedium_setState_dh_C_impl(in[0], in[1], (int)in[2], &state, m, l, s); break;
+		case Statistics::setSat_p: TwoPhaseMedium_setSat_p_C_impl(in[0], &sat, m, l, s); break;
+		case Statistics::setSat_T: TwoPhaseMedium_setSat_T_C_impl(in[0], &sat, m, l, s); break;
+		case Statistics::setBubbleState:
+		case Statistics::setDewState:
+			CallTrace::setSatValues(in, &sat);
+			if (call.function == Statistics::setBubbleState)
+				TwoPhaseMedium_setBubbleState_C_impl(&sat, (int)in[CallTrace::nSatValues], &state, m, l, s);
+			else
+				TwoPhaseMedium_setDewState_C_impl(&sat, (int)in[CallTrace::nSatValues], &state, m, l, s);
+			break;
+		case Statistics::partialDeriv_state:
+			CallTrace::setStateValues(in, &state);
+			out[0] = TwoPhaseMedium_partialDeriv_state_C_impl(text[0].c_str(), text[1].c_str(), text[2].c_str(), &state, m, l, s);
+			return 1;
+		case Statistics::isentropicEnthalpy:
+			CallTrace::setStateValues(in + 1, &state);
+			out[0] = TwoPhaseMedium_isentropicEnthalpy_C_impl(in[0], &state, m, l, s);
+			return 1;
+		case Statistics::saturationTemperature: out[0] = TwoPhaseMedium_saturationTemperature_C_impl(in[0], m, l, s); return 1;
+		case Statistics::saturationTemperature_derp: out[0] = TwoPhaseMedium_saturationTemperature_derp_C_impl(in[0], m, l, s); return 1;
+		case Statistics::saturationPressure: out[0] = TwoPhaseMedium_saturationPressure_C_impl(in[0], m, l, s); return 1;
+		default:
+			if (stateFunction(call.function)){
+				CallTrace::setStateValues(in, &state);
+				out[0] = stateFunction(call.function)(&state, m, l, s);
+			}
+			else if (satFunction(call.function)){
+				CallTrace::setSatValues(in, &sat);
+				out[0] = satFunction(call.function)(&sat, m, l, s);
+			}
+			else
+				throw std::runtime_error("the trace contains an unsupported function");
+			return 1;
+	}
+	if (call.function == Statistics::setSat_p || call.function == Statistics::setSat_T){
+		CallTrace::satValues(&sat, out);
+		return CallTrace::nSatValues;
+	}
+	CallTrace::stateValues(&state, out);
+	return CallTrace::nStateValues;
+}
+
+/*! Results of one function */
+struct FunctionReport{
+	FunctionReport() : errors(0), compared(0), sumDeviation(0), maxDeviation(0), nanMismatches(0){}
+	std::vector<double> latencies; /* nanoseconds */
+	long errors;
+	long compared;
+	double sumDeviation, maxDeviation;
+	long nanMismatches;
+	void merge(const FunctionReport &other){
+		latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+		errors += other.errors;
+		compared += other.compared;
+		sumDeviation += other.sumDeviation;
+		maxDeviation = std::max(maxDeviation, other.maxDeviation);
+		nanMismatches += other.nanMismatches;
+	}
+};
+
+/*! Results of one thread */
+struct ThreadReport{
+	std::vector<FunctionReport> functions;
+	string firstError;
+};
+
+//! Replay the whole trace in one thread
+static void replayThread(const ReplayTrace &trace, const std::vector<ReplaySolver> &solvers, int repeat, ThreadReport *report){
+	report->functions.resize(Statistics::nFunctions);
+	double out[2*CallTrace::nStateValues];
+	for (int r = 0; r < repeat; r++){
+		for (size_t i = 0; i < trace.calls.size(); i++){
+			const ReplayCall &call = trace.calls[i];
+			FunctionReport &function = report->functions[call.function];
+			const double *in = &trace.values[call.values];
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			int nOut;
+			try {
+				nOut = replayCall(call, in, call.nText ? &trace.text[call.text] : NULL, solvers[call.solver], out);
+			} catch (ReplayError &e){
+				function.errors++;
+				if (report->firstError.empty())
+					report->firstError = e.what();
+				continue;
+			}
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+			function.latencies.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+			// Relative deviation from the recorded outputs
+			const double *recorded = in + call.nIn;
+			for (int j = 0; j < std::min(nOut, call.nOut); j++){
+				if (std::isnan(recorded[j]) != std::isnan(out[j])){
+					function.nanMismatches++;
+					continue;
+				}
+				if (std::isnan(recorded[j]))
+					continue;
+				double deviation = fabs(out[j] - recorded[j]);
+				if (recorded[j] != 0)
+					deviation /= fabs(recorded[j]);
+				function.compared++;
+				function.sumDeviation += deviation;
+				function.maxDeviation = std::max(function.maxDeviation, deviation);
+			}
+		}
+	}
+}
+
+//! Format a number for JSON, NaN is written as null
+static string jsonNumber(double value){
+	if (std::isnan(value))
+		return "null";
+	std::ostringstream number;
+	number.precision(9);
+	number << value;
+	return number.str();
+}
+
+//! Return a percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double fraction){
+	if (sorted.empty())
+		return NAN;
+	size_t index = (size_t)ceil(fraction*sorted.size());
+	return sorted[index > 0 ? index - 1 : 0];
+}
+
+static void usage(){
+	std::cerr << "Usage: externalmedia_replay [--backend B] [--option key=value] [--threads N] [--repeat N] [--json FILE] [--tolerance X] trace_file" << std::endl;
+	exit(2);
+}
+
+int main(int argc, char *argv[]){
+	ReplaySettings settings;
+	settings.threads = 1;
+	settings.repeat = 1;
+	settings.tolerance = NAN;
+	string traceFile;
+	for (int i = 1; i < argc; i++){
+		string arg = argv[i];
+		if (arg == "--backend" && i + 1 < argc)
+			settings.backend = argv[++i];
+		else if (arg == "--option" && i + 1 < argc && strchr(argv[i + 1], '='))
+			settings.options.push_back(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc)
+			settings.threads = atoi(argv[++i]);
+		else if (arg == "--repeat" && i + 1 < argc)
+			settings.repeat = atoi(argv[++i]);
+		else if (arg == "--json" && i + 1 < argc)
+			settings.jsonFile = argv[++i];
+		else if (arg == "--tolerance" && i + 1 < argc)
+			settings.tolerance = atof(argv[++i]);
+		else if (traceFile.empty() && arg.compare(0, 2, "--"))
+			traceFile = arg;
+		else
+			usage();
+	}
+	if (traceFile.empty() || settings.threads < 1 || settings.repeat < 1)
+		usage();
+
+	ReplayTrace trace;
+	std::vector<std::vector<ReplaySolver> > solvers;
+	try {
+		readTrace(traceFile, trace);
+		for (int t = 0; t < settings.threads; t++){
+			solvers.push_back(threadSolvers(trace, settings, t));
+			// Create all solvers before timing, SolverMap is not thread safe
+			for (size_t i = 0; i < solvers[t].size(); i++){
+				const ReplaySolver &s = solvers[t][i];
+				if (t > 0 && s.libraryName.find("CoolProp") != 0)
+					throw std::runtime_error("--threads is only supported for CoolProp solvers");
+				TwoPhaseMedium_getMolarMass_C_impl(s.mediumName.c_str(), s.libraryName.c_str(), s.substanceName.c_str());
+			}
+		}
+	} catch (std::exception &e){
+		std::cerr << "externalmedia_replay: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::vector<ThreadReport> reports(settings.threads);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int t = 1; t < settings.threads; t++)
+		threads.push_back(std::thread(replayThread, std::cref(trace), std::cref(solvers[t]), settings.repeat, &reports[t]));
+	replayThread(trace, solvers[0], settings.repeat, &reports[0]);
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+	double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Merge the thread reports
+	std::vector<FunctionReport> functions(Statistics::nFunctions);
+	for (int t = 0; t < settings.threads; t++){
+		for (int i = 0; i < Statistics::nFunctions; i++)
+			functions[i].merge(reports[t].functions[i]);
+		if (!reports[t].firstError.empty())
+			std::cerr << "First error in thread " << t << ": " << reports[t].firstError << std::endl;
+	}
+	long long totalCalls = (long long)trace.calls.size()*settings.repeat*settings.threads;
+
+	// Text report
+	std::cout << "Trace: " << traceFile << ", " << trace.calls.size() << " calls, " << trace.solvers.size() << " solvers" << std::endl;
+	for (size_t i = 0; i < solvers[0].size(); i++)
+		std::cout << "Solver: " << solvers[0][i].libraryName << ", " << solvers[0][i].substanceName << std::endl;
+	std::cout << "Threads: " << settings.threads << ", repeat: " << settings.repeat << std::endl;
+	std::cout << "Wall time: " << wallTime << " s, throughput: " << totalCalls/wallTime << " calls/s" << std::endl << std::endl;
+	char line[512];
+	snprintf(line, sizeof(line), "%-30s %10s %7s %10s %10s %10s %10s %10s %11s %11s %6s",
+		"function", "calls", "errors", "mean[us]", "p50[us]", "p90[us]", "p99[us]", "max[us]", "max dev", "mean dev", "NaN");
+	std::cout << line << std::endl;
+
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\n  \"trace\": \"" << traceFile << "\",\n  \"threads\": " << settings.threads << ",\n  \"repeat\": " << settings.repeat
+	     << ",\n  \"calls\": " << totalCalls << ",\n  \"wall_time\": " << wallTime << ",\n  \"throughput\": " << totalCalls/wallTime
+	     << ",\n  \"functions\": {";
+	bool first = true;
+	for (int i = 0; i < Statistics::nFunctions; i++){
+		FunctionReport &f = functions[i];
+		if (f.latencies.empty() && f.errors == 0)
+			continue;
+		std::sort(f.latencies.begin(), f.latencies.end());
+		double sum = 0;
+		for (size_t j = 0; j < f.latencies.size(); j++)
+			sum += f.latencies[j];
+		double mean = f.latencies.empty() ? NAN : sum/f.latencies.size();
+		double meanDeviation = f.compared ? f.sumDeviation/f.compared : NAN;
+		snprintf(line, sizeof(line), "%-30s %10lu %7ld %10.3f %10.3f %10.3f %10.3f %10.3f %11.3e %11.3e %6ld",
+			Statistics::functionName((Statistics::Function)i), (unsigned long)f.latencies.size(), f.errors,
+			mean*1e-3, percentile(f.latencies, 0.5)*1e-3, percentile(f.latencies, 0.9)*1e-3, percentile(f.latencies, 0.99)*1e-3,
+			f.latencies.empty() ? NAN : f.latencies.back()*1e-3, f.maxDeviation, meanDeviation, f.nanMismatches);
+		std::cout << line << std::endl;
+
+		json << (first ? "\n" : ",\n") << "    \"" << Statistics::functionName((Statistics::Function)i) << "\": {"
+		     << "\"calls\": " << f.latencies.size() << ", \"errors\": " << f.errors
+		     << ", \"mean_ns\": " << jsonNumber(mean) << ", \"p50_ns\": " << jsonNumber(percentile(f.latencies, 0.5))
+		     << ", \"p90_ns\": " << jsonNumber(percentile(f.latencies, 0.9)) << ", \"p99_ns\": " << jsonNumber(percentile(f.latencies, 0.99))
+		     << ", \"max_ns\": " << jsonNumber(f.latencies.empty() ? NAN : f.latencies.back())
+		     << ", \"max_deviation\": " << f.maxDeviation << ", \"mean_deviation\": " << jsonNumber(meanDeviation)
+		     << ", \"nan_mismatches\": " << f.nanMismatches << "}";
+		first = false;
+	}
+	json << (first ? "}\n}\n" : "\n  }\n}\n");
+
+	if (!settings.jsonFile.empty()){
+		std::ofstream file(settings.jsonFile.c_str());
+		file << json.str();
+		if (!file){
+			std::cerr << "externalmedia_replay: could not write " << settings.jsonFile << std::endl;
+			return 1;
+		}
+	}
+
+	// Recorded calls that fail or give other outputs
+	if (!std::isnan(settings.tolerance)){
+		bool passed = true;
+		for (int i = 0; i < Statistics::nFunctions; i++){
+			const FunctionReport &f = functions[i];
+			if (f.errors == 0 && f.nanMismatches == 0 && !(f.maxDeviation > settings.tolerance))
+				continue;
+			std::cerr << "externalmedia_replay: " << Statistics::functionName((Statistics::Function)i) << " has " << f.errors << " errors, "
+			          << f.nanMismatches << " NaN mismatches and a maximum deviation of " << f.maxDeviation << std::endl;
+			passed = false;
+		}
+		if (!passed)
+			return 1;
+	}
+	return 0;
+}